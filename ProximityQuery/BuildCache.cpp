@@ -0,0 +1,152 @@
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+#include "BuildCache.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+#   include <direct.h>
+#else
+#   include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// bump when a builder or a post pass changes its output: the old files are then never hit again
+static const uint32_t   KEY_VERSION = 1;
+
+static inline uint64_t
+fnv1a(uint64_t h, uint32_t word) {
+    return (h ^ word) * 1099511628211ull;
+}
+
+static inline uint64_t
+fnv1a(uint64_t h, float f) {
+    uint32_t word;
+    memcpy(&word, &f, sizeof(word));
+    return fnv1a(h, word);
+}
+
+static bool
+makeDirectory(const std::string& directory) {
+#if defined(_WIN32)
+    return _mkdir(directory.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+BuildCache::Ptr
+BuildCache::create(const std::string& directory) {
+    if (!makeDirectory(directory)) {
+        cerr << "Error: unable to make the build cache directory " << directory << endl;
+        return nullptr;
+    }
+    return Ptr(new BuildCache(directory));
+}
+
+uint64_t
+BuildCache::key(const TriPositions& source, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses) {
+    uint64_t h = 14695981039346656037ull;
+    h = fnv1a(h, KEY_VERSION);
+    h = fnv1a(h, uint32_t(SIMD_WIDTH));     // the file layout
+    h = fnv1a(fnv1a(h, uint32_t(uint64_t(maxTriCountHint))), uint32_t(uint64_t(maxTriCountHint) >> 32));
+    h = fnv1a(h, uint32_t(method));
+    h = fnv1a(h, postPasses);
+    h = fnv1a(h, uint32_t(source.triCount));
+
+    for (size_t t = 0; t < source.triCount; ++t) {
+        for (size_t c = 0; c < 3; ++c) {
+            auto p = source(t, c);
+            h = fnv1a(fnv1a(fnv1a(h, p.x), p.y), p.z);
+        }
+    }
+    return h;
+}
+
+std::string
+BuildCache::fileName(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.pqcm", static_cast<unsigned long long>(key));
+    return directory_ + "/" + name;
+}
+
+template<typename Source>
+CollisionMesh::Ptr
+BuildCache::buildCached(Source source, const TriPositions& positions, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses, size_t threadCount) {
+    if (positions.positions == nullptr || positions.stride < 3 * sizeof(float)) {
+        return CollisionMesh::build(source, maxTriCountHint, method, threadCount);    // not hashable, the build reports it
+    }
+
+    auto name = fileName(key(positions, maxTriCountHint, method, postPasses));
+
+    // a file failing to map (another version, truncated) or saved from other triangles (a key collision) is built and
+    // saved again
+    if (ifstream(name).good()) {
+        auto cm = CollisionMesh::mapFrom(name, source);
+        if (cm != nullptr && cm->sourceMatchesFile()) {
+            ++hits_;
+            return cm;
+        }
+    }
+    ++misses_;
+
+    auto cm = CollisionMesh::build(source, maxTriCountHint, method, threadCount);
+    if (cm == nullptr) return nullptr;
+
+    if (postPasses & REORDER_NODES) cm->reorderNodes();
+    if (postPasses & QUANTIZE_LEAVES) cm->quantizeLeaves();
+    if (postPasses & MAKE_MESHLETS) cm->makeMeshlets();
+    if (postPasses & COMPRESS_NODES) cm->compressNodes();
+
+    // a name of its own per writer, renamed once complete
+    auto stamp = uint64_t(chrono::high_resolution_clock::now().time_since_epoch().count()) ^ uint64_t(hash<thread::id>()(this_thread::get_id()));
+    auto tmp = name + "." + to_string(stamp) + ".tmp";
+    if (!cm->saveTo(tmp)) {
+        std::remove(tmp.c_str());
+        return cm;
+    }
+
+    if (std::rename(tmp.c_str(), name.c_str()) != 0) {
+        // Windows doesn't replace an existing file: another writer was first, or the file didn't map
+        std::remove(name.c_str());
+        if (std::rename(tmp.c_str(), name.c_str()) != 0) std::remove(tmp.c_str());
+    }
+    return cm;
+}
+
+CollisionMesh::Ptr
+BuildCache::build(TriMesh::Ptr orig, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses, size_t threadCount) {
+    return buildCached(orig, TriPositions::of(*orig), maxTriCountHint, method, postPasses, threadCount);
+}
+
+CollisionMesh::Ptr
+BuildCache::build(IndexedTriMesh::Ptr orig, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses, size_t threadCount) {
+    return buildCached(orig, TriPositions::of(*orig), maxTriCountHint, method, postPasses, threadCount);
+}
+
+CollisionMesh::Ptr
+BuildCache::build(const TriPositions& source, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses, size_t threadCount) {
+    return buildCached<const TriPositions&>(source, source, maxTriCountHint, method, postPasses, threadCount);
+}
@@ -0,0 +1,72 @@
+#pragma once
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Content addressed build cache: a built collision mesh is saved in the cache directory (see CollisionMesh::saveTo)
+// under the hash of what makes it, the triangles and the build parameters. The next build of the same triangles with
+// the same parameters maps that file instead (see CollisionMesh::mapFrom), in any process.
+// - the builds are deterministic (whatever the thread count): a hit is the collision mesh the build would make
+// - the key is the corner positions of the triangles in order, bit for bit: the indexing and the attributes
+//   (normals, colors) are not part of it, a hit reads them from the mesh passed in
+// - a hit is checked against the positions saved in the file (linear, like the key): a key collision is a miss
+// - a file is written under a temporary name then renamed, the processes sharing a directory never map half a file
+// - the directory is never trimmed
+//
+#include <string>
+#include <memory>
+#include <atomic>
+
+#include "TriMesh.hpp"
+
+struct BuildCache {
+    typedef std::shared_ptr<BuildCache> Ptr;
+
+    // the post passes run after the build, in this order (a set of flags, part of the key)
+    static const uint32_t   REORDER_NODES = 1;      // see CollisionMesh::reorderNodes
+    static const uint32_t   QUANTIZE_LEAVES = 2;    // see CollisionMesh::quantizeLeaves
+    static const uint32_t   MAKE_MESHLETS = 4;      // see CollisionMesh::makeMeshlets
+    static const uint32_t   COMPRESS_NODES = 8;     // see CollisionMesh::compressNodes
+
+    // same contracts as CollisionMesh::build, mapped on a hit. Thread safe
+    CollisionMesh::Ptr  build(TriMesh::Ptr orig, size_t maxTriCountHint, CollisionMesh::BuildMethod method = CollisionMesh::BuildMethod::OCTREE, uint32_t postPasses = 0, size_t threadCount = 0);
+    CollisionMesh::Ptr  build(IndexedTriMesh::Ptr orig, size_t maxTriCountHint, CollisionMesh::BuildMethod method = CollisionMesh::BuildMethod::OCTREE, uint32_t postPasses = 0, size_t threadCount = 0);
+    CollisionMesh::Ptr  build(const TriPositions& source, size_t maxTriCountHint, CollisionMesh::BuildMethod method = CollisionMesh::BuildMethod::OCTREE, uint32_t postPasses = 0, size_t threadCount = 0);
+
+    // 64 bits FNV-1a of the triangle corners and the build parameters
+    static uint64_t     key(const TriPositions& source, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses);
+
+    std::string         fileName(uint64_t key) const;
+    const std::string&  directory() const { return directory_; }
+
+    size_t              hits() const { return hits_; }
+    size_t              misses() const { return misses_; }
+
+    // the directory is made if it is missing, null if it can't be
+    static Ptr          create(const std::string& directory);
+
+private:
+    BuildCache(const std::string& directory) : directory_(directory), hits_(0), misses_(0) {}
+
+    template<typename Source>
+    CollisionMesh::Ptr  buildCached(Source source, const TriPositions& positions, size_t maxTriCountHint, CollisionMesh::BuildMethod method, uint32_t postPasses, size_t threadCount);
+
+    std::string             directory_;
+    std::atomic<size_t>     hits_;
+    std::atomic<size_t>     misses_;
+};
@@ -0,0 +1,106 @@
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+#include "MappedFile.hpp"
+
+#include <iostream>
+
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+using namespace std;
+
+#if defined(_WIN32)
+
+MappedFile::Ptr
+MappedFile::open(const std::string& fileName) {
+    auto file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        cerr << "Error: unable to open " << fileName << endl;
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        cerr << "Error: unable to map the empty file " << fileName << endl;
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    // the mapping object keeps the file open
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+        cerr << "Error: unable to map " << fileName << endl;
+        return nullptr;
+    }
+
+    auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        cerr << "Error: unable to map " << fileName << endl;
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    return Ptr(new MappedFile(static_cast<const char*>(data), size_t(size.QuadPart), mapping));
+}
+
+MappedFile::~MappedFile() {
+    UnmapViewOfFile(data_);
+    CloseHandle(handle_);
+}
+
+#else
+
+MappedFile::Ptr
+MappedFile::open(const std::string& fileName) {
+    auto fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error: unable to open " << fileName << endl;
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        cerr << "Error: unable to map the empty file " << fileName << endl;
+        close(fd);
+        return nullptr;
+    }
+
+    auto data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping keeps its own reference to the file
+    if (data == MAP_FAILED) {
+        cerr << "Error: unable to map " << fileName << endl;
+        return nullptr;
+    }
+
+    return Ptr(new MappedFile(static_cast<const char*>(data), size_t(st.st_size), nullptr));
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Read only memory mapped file (mmap on POSIX, a file mapping on Windows):
+// - nothing is read when the file is opened, a page is loaded by the OS when it is first touched
+// - the pages are backed by the file: they are shared with the other processes mapping it and the page cache
+// - the mapping starts on a page boundary (at least 4096 bytes aligned)
+//
+#include <memory>
+#include <string>
+#include <cstddef>
+
+struct MappedFile {
+    typedef std::shared_ptr<MappedFile> Ptr;
+
+    ~MappedFile();
+
+    const char*     data() const { return data_; }
+    size_t          size() const { return size_; }
+
+    // null if the file can't be opened or mapped (an empty file can't be mapped either)
+    static Ptr      open(const std::string& fileName);
+
+private:
+    MappedFile(const char* data, size_t size, void* handle) : data_(data), size_(size), handle_(handle) {}
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    const char*     data_;
+    size_t          size_;
+    void*           handle_;    // the file mapping object on Windows, unused on POSIX (the mapping outlives the descriptor)
+};
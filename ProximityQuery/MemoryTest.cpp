@@ -0,0 +1,225 @@
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Memory checks of the collision mesh, no GL: the global operator new/delete count the allocations.
+// - the queries (single, radius, batch, executor) never allocate, whatever the node format, leaf format and traversal
+// - the peak memory of a build stays close to the collision mesh it makes: the builders partition one id array
+// Returns 1 if a check fails
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <atomic>
+#include <vector>
+
+#include <glm/glm/glm.hpp>
+
+#include "TriMesh.hpp"
+#include "QueryExecutor.hpp"
+
+using namespace glm;
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// counting allocator
+
+static atomic<size_t>   allocations(0);
+static atomic<size_t>   liveBytes(0);
+static atomic<size_t>   peakBytes(0);
+
+// the size is kept in front of the block, a header keeps the malloc alignment
+static const size_t     HEADER_BYTES = 16;
+
+// GCC pairs the inlined deletes with its builtin operator new, not with the malloc below
+#if defined(__GNUC__) && !defined(__clang__)
+#   pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void*
+operator new(size_t size) {
+    auto p = static_cast<char*>(malloc(size + HEADER_BYTES));
+    if (p == nullptr) throw bad_alloc();
+    *reinterpret_cast<size_t*>(p) = size;
+
+    ++allocations;
+    auto live = liveBytes += size;
+    auto peak = peakBytes.load();
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+    return p + HEADER_BYTES;
+}
+
+void*
+operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void
+operator delete(void* p) noexcept {
+    if (p == nullptr) return;
+
+    auto block = static_cast<char*>(p) - HEADER_BYTES;
+    liveBytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+void
+operator delete[](void* p) noexcept {
+    ::operator delete(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// a torus of rings x sides quads, 2 triangles each
+static IndexedTriMesh::Ptr
+torus(size_t rings, size_t sides) {
+    vector<IndexedTriMesh::Vertex> vertices;
+    vector<uint32_t> indices;
+
+    for (size_t r = 0; r < rings; ++r) {
+        for (size_t s = 0; s < sides; ++s) {
+            float u = 2.0f * 3.14159265f * r / rings;
+            float v = 2.0f * 3.14159265f * s / sides;
+            IndexedTriMesh::Vertex vertex;
+            vertex.position = vec3((1.0f + 0.3f * cos(v)) * cos(u), (1.0f + 0.3f * cos(v)) * sin(u), 0.3f * sin(v));
+            vertex.normal = vec3(cos(v) * cos(u), cos(v) * sin(u), sin(v));
+            vertex.color = vec4(1.0f);
+            vertices.push_back(vertex);
+
+            uint32_t q[4] = { uint32_t(r * sides + s), uint32_t(((r + 1) % rings) * sides + s)
+                            , uint32_t(((r + 1) % rings) * sides + (s + 1) % sides), uint32_t(r * sides + (s + 1) % sides) };
+            indices.insert(indices.end(), { q[0], q[1], q[2], q[0], q[2], q[3] });
+        }
+    }
+    return IndexedTriMesh::create(std::move(vertices), std::move(indices));
+}
+
+// deterministic points in [-1.5, 1.5]^3
+static vector<vec3>
+queryPoints(size_t count) {
+    vector<vec3> pts(count);
+    uint32_t seed = 12345;
+    auto next = [&] { seed = seed * 1664525u + 1013904223u; return float(seed >> 8) / float(1 << 24) * 3.0f - 1.5f; };
+    for (auto& p : pts) {
+        float x = next();
+        float y = next();
+        p = vec3(x, y, next());
+    }
+    return pts;
+}
+
+enum class LeafPass { RECORDS, QUANTIZED, MESHLETS };
+
+static const char*
+name(LeafPass leaves) {
+    switch (leaves) {
+    case LeafPass::QUANTIZED:   return "QUANTIZED";
+    case LeafPass::MESHLETS:    return "MESHLETS";
+    default:                    return "RECORDS";
+    }
+}
+
+// the allocations of all the query kinds over one collision mesh
+static size_t
+queryAllocations(const ProximityQuery& query, QueryExecutor& executor, const vector<vec3>& pts) {
+    auto count = pts.size();
+    vector<float> radii(count, 0.2f);
+    vector<vec3> outPts(count);
+    vector<float> outDists(count);
+    vector<int> outLeaves(count);
+
+    auto before = allocations.load();
+
+    for (size_t i = 0; i < count; ++i) {
+        int leaf;
+        int tri;
+        outPts[i] = query.closestPointOnMesh(pts[i], 0.2f, leaf);
+        outPts[i] = query.closestPointOnMesh(pts[i], 0.2f, leaf, tri);
+        outPts[i] = query.closestPointOnMesh(pts[i], leaf);
+    }
+
+    query.closestPointsOnMesh(count, pts.data(), radii.data(), outPts.data(), outDists.data(), outLeaves.data());
+    query.closestPointsOnMesh(count, pts.data(), nullptr, outPts.data(), outDists.data(), outLeaves.data());
+    executor.closestPointsOnMesh(query, count, pts.data(), radii.data(), outPts.data(), outDists.data(), outLeaves.data());
+    executor.closestPointsOnMesh(query, count, pts.data(), nullptr, outPts.data(), outDists.data(), outLeaves.data());
+
+    return allocations.load() - before;
+}
+
+static size_t
+checkQueries(IndexedTriMesh::Ptr mesh) {
+    size_t fails = 0;
+    auto pts = queryPoints(4096);
+    auto executor = QueryExecutor::create(4);
+
+    for (auto leaves : { LeafPass::RECORDS, LeafPass::QUANTIZED, LeafPass::MESHLETS }) {
+        for (auto compressed : { false, true }) {
+            auto cm = CollisionMesh::build(mesh, 16, CollisionMesh::BuildMethod::SAH);
+            if (leaves == LeafPass::QUANTIZED) cm->quantizeLeaves();
+            if (leaves == LeafPass::MESHLETS) cm->makeMeshlets();
+            if (compressed) cm->compressNodes();
+
+            for (auto traversal : { ProximityQuery::Traversal::DEPTH_FIRST, ProximityQuery::Traversal::BEST_FIRST }) {
+                auto query = ProximityQuery::create(cm, traversal);
+                auto count = queryAllocations(*query, *executor, pts);
+
+                printf("queries %-9s %-10s %-11s: %zu allocations\n", name(leaves), compressed ? "COMPRESSED" : "WIDE"
+                     , traversal == ProximityQuery::Traversal::BEST_FIRST ? "BEST_FIRST" : "DEPTH_FIRST", count);
+                if (count != 0) ++fails;
+            }
+        }
+    }
+    return fails;
+}
+
+// the build overhead: the peak live bytes of the build minus the live bytes of the collision mesh it returns.
+// The triangle boxes, the id scratch and the flat trees are transient, the peak is at most the output plus
+// MAX_BUILD_OVERHEAD per triangle
+static const double     MAX_BUILD_OVERHEAD = 16.0;
+
+static size_t
+checkBuilds(IndexedTriMesh::Ptr mesh) {
+    size_t fails = 0;
+    auto triCount = mesh->triCount();
+
+    for (auto method : { CollisionMesh::BuildMethod::OCTREE, CollisionMesh::BuildMethod::SAH, CollisionMesh::BuildMethod::LBVH }) {
+        auto before = liveBytes.load();
+        peakBytes = before;
+
+        auto cm = CollisionMesh::build(mesh, 32, method, 4);
+
+        auto output = double(liveBytes.load() - before) / triCount;
+        auto overhead = double(peakBytes.load() - liveBytes.load()) / triCount;
+        const char* names[] = { "OCTREE", "SAH", "LBVH" };
+        printf("build %-6s: %.1f bytes/tri output, %.1f bytes/tri overhead\n", names[int(method)], output, overhead);
+        if (overhead > MAX_BUILD_OVERHEAD) ++fails;
+    }
+    return fails;
+}
+
+int
+main() {
+    auto mesh = torus(256, 128);
+
+    size_t fails = checkQueries(mesh);
+    fails += checkBuilds(torus(1024, 512));
+
+    printf("%s: %zu failed\n", fails ? "FAILED" : "OK", fails);
+    return fails ? 1 : 0;
+}
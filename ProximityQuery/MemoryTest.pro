@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Memory checks of the collision mesh, no GL:
+# the queries never allocate, the peak build memory stays close to
+# the collision mesh. Exits with 1 on a failed check
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = MemoryTest
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../include
+
+QMAKE_CXXFLAGS += -std=c++11 -pthread
+# same ISA as ProximityQuery.pro
+avx512 {
+    QMAKE_CXXFLAGS += -mavx512f -mavx2 -mfma
+} else {
+    QMAKE_CXXFLAGS += -mavx2 -mfma
+}
+LIBS += -pthread
+
+SOURCES += MemoryTest.cpp \
+    TriMesh.cpp \
+    MappedFile.cpp \
+    QueryExecutor.cpp
+
+HEADERS += \
+    TriMesh.hpp \
+    MappedFile.hpp \
+    Simd.hpp \
+    QueryExecutor.hpp
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <stdio.h>
 #include <cstring>
+#include <unordered_map>
 
 using namespace std;
 using namespace glm;
@@ -35,24 +36,34 @@ struct objTri {
     objVertex   v[3];
 };
 
+// the OBJ attributes and the 1 based attribute indices of every triangle corner
+struct objData {
+    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
+    std::vector<glm::vec3> temp_vertices;
+    std::vector<glm::vec2> temp_uvs;
+    std::vector<glm::vec3> temp_normals;
+};
+
 //
 // adapted from: https://github.com/opengl-tutorials/ogl/blob/master/common/objloader.cpp
 //
-TriMesh::Ptr
-loadFrom(const std::string& path) {
+static bool
+parseObj(const std::string& path, objData& obj) {
     cout << "Loading OBJ file " << path << "..." << endl;
 
-    std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    std::vector<glm::vec3> temp_vertices;
-    std::vector<glm::vec2> temp_uvs;
-    std::vector<glm::vec3> temp_normals;
+    auto& vertexIndices = obj.vertexIndices;
+    auto& uvIndices = obj.uvIndices;
+    auto& normalIndices = obj.normalIndices;
+    auto& temp_vertices = obj.temp_vertices;
+    auto& temp_uvs = obj.temp_uvs;
+    auto& temp_normals = obj.temp_normals;
 
 
     FILE * file = fopen(path.c_str(), "r");
     if (file == NULL) {
         cout << "Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details" << endl;
         getchar();
-        return nullptr;
+        return false;
     }
 
     while (1) {
@@ -87,6 +98,7 @@ loadFrom(const std::string& path) {
             int matches = fscanf(file, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2]);
             if (matches != 6) {
                 cout << "File can't be read by our simple parser :-( Try exporting with other options" << endl;
+                fclose(file);
                 return false;
             }
             vertexIndices.push_back(vertexIndex[0]);
@@ -107,6 +119,21 @@ loadFrom(const std::string& path) {
 
     }
 
+    fclose(file);
+    return true;
+}
+
+TriMesh::Ptr
+loadFrom(const std::string& path) {
+    objData obj;
+    if (!parseObj(path, obj)) return nullptr;
+
+    const auto& vertexIndices = obj.vertexIndices;
+    const auto& uvIndices = obj.uvIndices;
+    const auto& normalIndices = obj.normalIndices;
+    const auto& temp_vertices = obj.temp_vertices;
+    const auto& temp_normals = obj.temp_normals;
+
     std::vector<TriMesh::Tri> tris;
 
     // For each vertex of each triangle
@@ -133,3 +160,34 @@ loadFrom(const std::string& path) {
 
     return TriMesh::Ptr(new TriMesh(tris));
 }
+
+//
+// the OBJ shared vertices are kept: one vertex per distinct position/normal pair.
+// The positions welding merges the pairs with the same position (the normal of the first one wins)
+//
+IndexedTriMesh::Ptr
+loadIndexedFrom(const std::string& path, IndexedTriMesh::Weld weld) {
+    objData obj;
+    if (!parseObj(path, obj)) return nullptr;
+
+    std::unordered_map<uint64_t, uint32_t> pairs;
+    std::vector<IndexedTriMesh::Vertex> vertices;
+    std::vector<uint32_t> indices(obj.vertexIndices.size());
+
+    for (size_t i = 0; i < obj.vertexIndices.size(); ++i) {
+        auto vertexIndex = obj.vertexIndices[i];
+        auto normalIndex = obj.normalIndices[i];
+
+        auto it = pairs.insert(std::make_pair((uint64_t(vertexIndex) << 32) | normalIndex, uint32_t(vertices.size())));
+        if (it.second) {
+            IndexedTriMesh::Vertex v;
+            v.position = obj.temp_vertices[vertexIndex - 1];
+            v.normal = obj.temp_normals[normalIndex - 1];
+            v.color = vec4(.5f, .5f, .5f, .5f);
+            vertices.push_back(v);
+        }
+        indices[i] = it.first->second;
+    }
+
+    return IndexedTriMesh::create(std::move(vertices), std::move(indices), weld);
+}
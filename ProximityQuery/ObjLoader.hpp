@@ -20,3 +20,4 @@
 #include "TriMesh.hpp"
 
 TriMesh::Ptr loadFrom(const std::string& path);
+IndexedTriMesh::Ptr loadIndexedFrom(const std::string& path, IndexedTriMesh::Weld weld = IndexedTriMesh::Weld::NONE);
@@ -18,7 +18,15 @@ PKGCONFIG += glfw3 glew
 
 INCLUDEPATH += ../include
 
-QMAKE_CXXFLAGS += -std=c++11
+QMAKE_CXXFLAGS += -std=c++11 -pthread
+# AVX2 like the vcxproj: the SIMD_WIDTH of the build is in the saved files and the build cache keys.
+# CONFIG+=avx512 builds the 16 lanes kernels, their files only map in an AVX-512 build
+avx512 {
+    QMAKE_CXXFLAGS += -mavx512f -mavx2 -mfma
+} else {
+    QMAKE_CXXFLAGS += -mavx2 -mfma
+}
+LIBS += -pthread
 
 SOURCES += main.cpp \
     imgui/imgui.cpp \
@@ -26,6 +34,9 @@ SOURCES += main.cpp \
     ObjLoader.cpp \
     Render.cpp \
     TriMesh.cpp \
+    BuildCache.cpp \
+    MappedFile.cpp \
+    QueryExecutor.cpp \
 	TrackBall.cpp
 
 HEADERS += \
@@ -35,6 +46,10 @@ HEADERS += \
     ObjLoader.hpp \
     Render.hpp \
     TriMesh.hpp \
+    BuildCache.hpp \
+    MappedFile.hpp \
+    Simd.hpp \
+    QueryExecutor.hpp \
 	TrackBall.cpp
 
 OTHER_FILES += \
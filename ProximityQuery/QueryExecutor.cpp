@@ -0,0 +1,165 @@
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+#include "QueryExecutor.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+static inline uint64_t  packRange(uint32_t begin, uint32_t end) { return (uint64_t(begin) << 32) | end; }
+static inline uint32_t  rangeBegin(uint64_t range) { return uint32_t(range >> 32); }
+static inline uint32_t  rangeEnd(uint64_t range) { return uint32_t(range & 0xFFFFFFFF); }
+
+const size_t QueryExecutor::CHUNK_SIZE;     // std::min binds it to a reference: it needs a definition
+
+QueryExecutor::Ptr
+QueryExecutor::create(size_t threadCount) {
+    if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;  // hardware_concurrency is only a hint
+    return Ptr(new QueryExecutor(threadCount));
+}
+
+QueryExecutor::QueryExecutor(size_t threadCount) : workers_(threadCount)
+                                                 , shares_(new Share[threadCount])
+                                                 , generation_(0)
+                                                 , busy_(0)
+                                                 , quit_(false) {
+    for (size_t w = 0; w < threadCount; ++w) {
+        shares_[w].range.store(packRange(0, 0));
+    }
+
+    for (size_t w = 1; w < threadCount; ++w) {
+        workers_[w] = std::thread(&QueryExecutor::workerLoop, this, w);
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        quit_ = true;
+    }
+    wake_.notify_all();
+
+    for (auto& w : workers_) {
+        if (w.joinable()) w.join();
+    }
+}
+
+void
+QueryExecutor::workerLoop(size_t worker) {
+    uint64_t seen = 0;
+
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [&] { return quit_ || generation_ != seen; });
+        if (quit_) return;
+
+        seen = generation_;
+
+        lock.unlock();
+        run(worker);
+        lock.lock();
+
+        if (--busy_ == 0) done_.notify_all();
+    }
+}
+
+void
+QueryExecutor::closestPointsOnMesh(const ProximityQuery& query, size_t count, const glm::vec3* pts, const float* radii, glm::vec3* outPts, float* outDists, int* outLeaves) {
+    if (count == 0) return;
+
+    lock_guard<mutex> batch(batchMutex_);
+
+    auto chunkCount = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    auto n = workers_.size();
+
+    // even initial split, the stealing takes care of the imbalance
+    for (size_t w = 0; w < n; ++w) {
+        shares_[w].range.store(packRange(uint32_t(chunkCount * w / n), uint32_t(chunkCount * (w + 1) / n)));
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        job_ = { &query, count, pts, radii, outPts, outDists, outLeaves };
+        busy_ = n - 1;
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    run(0);
+
+    unique_lock<mutex> lock(mutex_);
+    done_.wait(lock, [&] { return busy_ == 0; });
+}
+
+void
+QueryExecutor::run(size_t worker) {
+    uint32_t chunk;
+
+    while (popFront(worker, chunk) || steal(worker, chunk)) {
+        auto begin = size_t(chunk) * CHUNK_SIZE;
+        auto count = std::min(CHUNK_SIZE, job_.count - begin);
+
+        job_.query->closestPointsOnMesh(count
+                                      , job_.pts + begin
+                                      , job_.radii ? job_.radii + begin : nullptr
+                                      , job_.outPts + begin
+                                      , job_.outDists + begin
+                                      , job_.outLeaves + begin);
+    }
+}
+
+bool
+QueryExecutor::popFront(size_t worker, uint32_t& chunk) {
+    auto& range = shares_[worker].range;
+    auto r = range.load();
+
+    while (rangeBegin(r) < rangeEnd(r)) {
+        if (range.compare_exchange_weak(r, packRange(rangeBegin(r) + 1, rangeEnd(r)))) {
+            chunk = rangeBegin(r);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+QueryExecutor::steal(size_t thief, uint32_t& chunk) {
+    auto n = workers_.size();
+
+    for (size_t i = 1; i < n; ++i) {
+        auto& range = shares_[(thief + i) % n].range;
+        auto r = range.load();
+
+        while (rangeBegin(r) < rangeEnd(r)) {
+            // take the back half (rounded up), the victim keeps eating its front
+            auto half = (rangeEnd(r) - rangeBegin(r) + 1) / 2;
+            auto split = rangeEnd(r) - half;
+
+            if (range.compare_exchange_weak(r, packRange(rangeBegin(r), split))) {
+                chunk = split;
+                shares_[thief].range.store(packRange(split + 1, rangeEnd(r)));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,87 @@
+#pragma once
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Parallel batch driver for ProximityQuery:
+// - the query array is cut into chunks of CHUNK_SIZE points (a multiple of the packet size)
+// - every worker starts with an even, contiguous share of the chunks and eats it from the front
+// - a worker running out of chunks steals the back half of another worker's share
+// - the queries are read only (see README), so all the workers share the same CollisionMesh
+//
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "TriMesh.hpp"
+
+struct QueryExecutor {
+    typedef std::shared_ptr<QueryExecutor> Ptr;
+
+    static const size_t CHUNK_SIZE = ProximityQuery::PACKET_SIZE * 32;
+
+    ~QueryExecutor();
+
+    // same contract as ProximityQuery::closestPointsOnMesh, the calling thread works too and returns once all the points are answered.
+    // One batch at a time: the concurrent calls wait for the batch in flight (the workers and the shares serve a single job)
+    void            closestPointsOnMesh(const ProximityQuery& query, size_t count, const glm::vec3* pts, const float* radii, glm::vec3* outPts, float* outDists, int* outLeaves);
+
+    size_t          threadCount() const { return workers_.size(); }
+
+    // threadCount = 0 uses all the hardware threads
+    static Ptr      create(size_t threadCount = 0);
+
+private:
+    struct Job {
+        const ProximityQuery*   query;
+        size_t                  count;
+        const glm::vec3*        pts;
+        const float*            radii;
+        glm::vec3*              outPts;
+        float*                  outDists;
+        int*                    outLeaves;
+    };
+
+    // [begin, end) chunk range packed as (begin << 32 | end), padded to its own cache line
+    struct Share {
+        std::atomic<uint64_t>   range;
+        char                    pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    QueryExecutor(size_t threadCount);
+
+    void            workerLoop(size_t worker);
+    void            run(size_t worker);
+    bool            popFront(size_t worker, uint32_t& chunk);
+    bool            steal(size_t thief, uint32_t& chunk);
+
+    std::vector<std::thread>    workers_;   // workers_[0] is a placeholder for the calling thread
+    std::unique_ptr<Share[]>    shares_;
+
+    std::mutex                  batchMutex_;    // held for a whole closestPointsOnMesh call
+    std::mutex                  mutex_;
+    std::condition_variable     wake_;
+    std::condition_variable     done_;
+    Job                         job_;
+    uint64_t                    generation_;
+    size_t                      busy_;
+    bool                        quit_;
+};
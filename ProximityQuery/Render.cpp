@@ -350,7 +350,8 @@ TriMeshShader::render(const glm::mat4& proj
     , const glm::mat4& mv
     , const glm::vec3& lightPos
     , GLuint vb
-    , size_t triCount) const
+    , size_t triCount
+    , GLuint ib) const
 {
     glUseProgram(shader_->program());
     glBindBuffer(GL_ARRAY_BUFFER, vb);
@@ -372,7 +373,13 @@ TriMeshShader::render(const glm::mat4& proj
     glUniform4f(lightColor_, 0.5f, 0.5f, 0.5f, 1.0f);
     glUniform4f(ambientColor_, 1.0f, 1.0f, 1.0f, 1.0f);
 
-    glDrawArrays(GL_TRIANGLES, 0, triCount * 3);
+    if (ib != 0) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib);
+        glDrawElements(GL_TRIANGLES, GLsizei(triCount * 3), GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    } else {
+        glDrawArrays(GL_TRIANGLES, 0, triCount * 3);
+    }
 
     glDisableVertexAttribArray(vertexPosition_);
     glDisableVertexAttribArray(vertexNormal_);
@@ -382,6 +389,7 @@ TriMeshShader::render(const glm::mat4& proj
 ////////////////////////////////////////////////////////////////////////////////
 TriMeshView::~TriMeshView() {
     glDeleteBuffers(1, &vb_);
+    if (ib_ != 0) glDeleteBuffers(1, &ib_);
 }
 
 TriMeshView::Ptr
@@ -396,12 +404,33 @@ TriMeshView::from(TriMesh::Ptr mesh) {
         return nullptr;
     }
 
-    return Ptr(new TriMeshView(mesh->tris().size(), vb));
+    return Ptr(new TriMeshView(mesh->tris().size(), vb, 0));
+}
+
+TriMeshView::Ptr
+TriMeshView::from(IndexedTriMesh::Ptr mesh) {
+    GLuint buffers[2];
+    glGenBuffers(2, buffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, mesh->vertices().size() * sizeof(IndexedTriMesh::Vertex), mesh->vertices().data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indices().size() * sizeof(uint32_t), mesh->indices().data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    if (glGetError() != GL_NO_ERROR) {
+        cerr << "Error: couldn't create TriMeshView" << endl;
+        glDeleteBuffers(2, buffers);
+        return nullptr;
+    }
+
+    return Ptr(new TriMeshView(mesh->triCount(), buffers[0], buffers[1]));
 }
 
 void
 TriMeshView::render(const glm::mat4& proj, const glm::mat4& mv, const glm::vec3& eye) const {
-    TriMeshShader::instance()->render(proj, mv, eye, vb_, triCount_);
+    TriMeshShader::instance()->render(proj, mv, eye, vb_, triCount_, ib_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -415,30 +444,50 @@ CollisionMeshView::render(const glm::mat4& proj, const glm::mat4& mv, const glm:
 void
 CollisionMeshView::renderLeaves(LineQueueView::Ptr queue, const glm::mat4& proj, const glm::mat4& mv) const {
     auto mvp = proj * mv;
-    for (auto l : leaves_) {
-        queue->queueCube(mvp, l.bbox(), false, l.color());
+    for (size_t i = 0; i < leafBoxes_.size(); ++i) {
+        queue->queueCube(mvp, leafBoxes_[i], false, leafColors_[i]);
     }
 }
 
+// debug color of a leaf, hashed from its index so a rebuild of the same mesh gets the same colors
+static glm::vec4
+leafColor(size_t leaf) {
+    uint32_t h = uint32_t(leaf) * 2654435761u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return glm::vec4(float(h & 0xFF) / 255.0f, float((h >> 8) & 0xFF) / 255.0f, float((h >> 16) & 0xFF) / 255.0f, 0.0f);
+}
 
 CollisionMeshView::Ptr
 CollisionMeshView::from(CollisionMesh::Ptr m) {
-    vector<AABBNode>    boxes;
+    vector<AABB>        boxes;
+    vector<vec4>        colors;
     vector<TriMeshView::Ptr> triMeshes;
 
-    auto nodes = m->nodes();
-    auto leaves = m->leaves();
+    const auto& leaves = m->leaves();
 
-    for (auto n : nodes) {
-        if(n.type() == AABBNode::Type::LEAF)
-            boxes.push_back(n);
+    for (size_t l = 0; l < leaves.size(); ++l) {
+        if (leaves[l].triCount == 0) continue;     // emptied or replaced by the edits
+        boxes.push_back(m->leafBoxes()[l]);
+        colors.push_back(leafColor(l));
     }
 
-    for (auto l : leaves) {
-        if (l->tris().size() > 0) {
-            triMeshes.push_back(TriMeshView::from(l));
+    // the leaf triangles come from the source mesh, through the collision mesh triangle ids
+    const auto& triIds = m->triIds();
+
+    for (size_t l = 0; l < leaves.size(); ++l) {
+        if (leaves[l].triCount > 0) {
+            vector<TriMesh::Tri> tris;
+            auto color = leafColor(l);
+            for (size_t i = leaves[l].firstTri; i < leaves[l].firstTri + leaves[l].triCount; ++i) {
+                auto t = m->sourceTri(triIds[i]);
+                t.v[0].color = t.v[1].color = t.v[2].color = color;     // for debugging purposes
+                tris.push_back(t);
+            }
+            triMeshes.push_back(TriMeshView::from(TriMesh::Ptr(new TriMesh(tris))));
         }
     }
 
-    return Ptr(new CollisionMeshView(m->rootId(), boxes, triMeshes));
+    return Ptr(new CollisionMeshView(m->rootId(), boxes, colors, triMeshes));
 }
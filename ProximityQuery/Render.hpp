@@ -111,7 +111,8 @@ struct TriMeshShader {
                           , const glm::mat4& mv
                           , const glm::vec3& lightPos
                           , GLuint vb
-                          , size_t triCount) const;
+                          , size_t triCount
+                          , GLuint ib = 0) const;    // ib: uint32 element buffer of an indexed mesh, 0 for a soup
 
 
     static Ptr      instance();
@@ -146,13 +147,15 @@ struct TriMeshView {
     void            render(const glm::mat4& proj, const glm::mat4& mv, const glm::vec3& eye) const;
 
     static Ptr      from(TriMesh::Ptr m);
+    static Ptr      from(IndexedTriMesh::Ptr m);   // the shared vertices and the indices are uploaded as they are
 
 private:
 
-    TriMeshView(size_t triCount, GLuint vb) : triCount_(triCount), vb_(vb) {}
+    TriMeshView(size_t triCount, GLuint vb, GLuint ib) : triCount_(triCount), vb_(vb), ib_(ib) {}
     
     size_t          triCount_;
     GLuint          vb_;
+    GLuint          ib_;    // 0 for a soup
 };
 
 struct CollisionMeshView {
@@ -164,9 +167,11 @@ struct CollisionMeshView {
     static Ptr      from(CollisionMesh::Ptr m);
 
 private:
-    CollisionMeshView(size_t rootIdx, const std::vector<AABBNode>& leaves, const std::vector<TriMeshView::Ptr>& triMeshes) : rootIdx_(rootIdx), leaves_(leaves), triMeshes_(triMeshes) {}
+    CollisionMeshView(size_t rootIdx, const std::vector<AABB>& leafBoxes, const std::vector<glm::vec4>& leafColors, const std::vector<TriMeshView::Ptr>& triMeshes)
+        : rootIdx_(rootIdx), leafBoxes_(leafBoxes), leafColors_(leafColors), triMeshes_(triMeshes) {}
 
     size_t          rootIdx_;
-    std::vector<AABBNode>   leaves_;
+    std::vector<AABB>       leafBoxes_;
+    std::vector<glm::vec4>  leafColors_;    // debug colors, the collision mesh nodes don't carry any
     std::vector<TriMeshView::Ptr>   triMeshes_;
 };
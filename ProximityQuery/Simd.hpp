@@ -0,0 +1,215 @@
+#pragma once
+//
+// Triangular Mesh Proximity Query
+// Copyright(C) 2016 Wael El Oraiby
+//
+// This program is free software : you can redistribute it and / or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.If not, see <http://www.gnu.org/licenses/>.
+//
+
+//
+// Minimal SIMD wrapper for the leaf kernels: SIMD_WIDTH floats processed per instruction.
+// - AVX-512 : 16 lanes (compile with -mavx512f or /arch:AVX512)
+// - AVX2    :  8 lanes (compile with -mavx2 or /arch:AVX2)
+// - else    :  8 lanes of plain loops, left to the compiler auto-vectorizer
+//
+// The same operations are overloaded for float/bool, so a kernel written as a template runs on one
+// lane (float) or on SIMD_WIDTH lanes (SimdFloat) unchanged.
+//
+// Note: simdMin/simdMax follow the SSE semantic (a < b ? a : b), a NaN in the first operand yields the second one.
+//
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#   include <immintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+#if defined(__AVX512F__)
+
+static const size_t SIMD_WIDTH = 16;
+
+struct SimdFloat { __m512 v; };
+struct SimdMask { __mmask16 m; };
+
+inline SimdFloat    simdLoad(const float* p) { return { _mm512_loadu_ps(p) }; }
+inline void         simdStore(float* p, SimdFloat a) { _mm512_storeu_ps(p, a.v); }
+inline SimdFloat    simdSet(float f) { return { _mm512_set1_ps(f) }; }
+inline SimdFloat    simdLoadU16(const uint16_t* p) { return { _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)))) }; }
+inline SimdFloat    simdGather(const float* base, const int32_t* offsets) { return { _mm512_i32gather_ps(_mm512_loadu_si512(offsets), base, 4) }; }
+
+inline SimdFloat    operator + (SimdFloat a, SimdFloat b) { return { _mm512_add_ps(a.v, b.v) }; }
+inline SimdFloat    operator - (SimdFloat a, SimdFloat b) { return { _mm512_sub_ps(a.v, b.v) }; }
+inline SimdFloat    operator * (SimdFloat a, SimdFloat b) { return { _mm512_mul_ps(a.v, b.v) }; }
+inline SimdFloat    operator / (SimdFloat a, SimdFloat b) { return { _mm512_div_ps(a.v, b.v) }; }
+
+inline SimdMask     operator <  (SimdFloat a, SimdFloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+inline SimdMask     operator <= (SimdFloat a, SimdFloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+inline SimdMask     operator >= (SimdFloat a, SimdFloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+inline SimdMask     operator & (SimdMask a, SimdMask b) { return { __mmask16(a.m & b.m) }; }
+
+inline SimdFloat    simdMin(SimdFloat a, SimdFloat b) { return { _mm512_min_ps(a.v, b.v) }; }
+inline SimdFloat    simdMax(SimdFloat a, SimdFloat b) { return { _mm512_max_ps(a.v, b.v) }; }
+inline SimdFloat    simdSelect(SimdMask m, SimdFloat a, SimdFloat b) { return { _mm512_mask_blend_ps(m.m, b.v, a.v) }; }
+
+inline float        simdHMin(SimdFloat a) { return _mm512_reduce_min_ps(a.v); }
+
+////////////////////////////////////////////////////////////////////////////////
+#elif defined(__AVX2__)
+
+static const size_t SIMD_WIDTH = 8;
+
+struct SimdFloat { __m256 v; };
+struct SimdMask { __m256 m; };
+
+inline SimdFloat    simdLoad(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline void         simdStore(float* p, SimdFloat a) { _mm256_storeu_ps(p, a.v); }
+inline SimdFloat    simdSet(float f) { return { _mm256_set1_ps(f) }; }
+inline SimdFloat    simdLoadU16(const uint16_t* p) { return { _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))) }; }
+inline SimdFloat    simdGather(const float* base, const int32_t* offsets) { return { _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets)), 4) }; }
+
+inline SimdFloat    operator + (SimdFloat a, SimdFloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline SimdFloat    operator - (SimdFloat a, SimdFloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline SimdFloat    operator * (SimdFloat a, SimdFloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline SimdFloat    operator / (SimdFloat a, SimdFloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+
+inline SimdMask     operator <  (SimdFloat a, SimdFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline SimdMask     operator <= (SimdFloat a, SimdFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline SimdMask     operator >= (SimdFloat a, SimdFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline SimdMask     operator & (SimdMask a, SimdMask b) { return { _mm256_and_ps(a.m, b.m) }; }
+
+inline SimdFloat    simdMin(SimdFloat a, SimdFloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline SimdFloat    simdMax(SimdFloat a, SimdFloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline SimdFloat    simdSelect(SimdMask m, SimdFloat a, SimdFloat b) { return { _mm256_blendv_ps(b.v, a.v, m.m) }; }
+
+inline float
+simdHMin(SimdFloat a) {
+    auto m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#else
+
+static const size_t SIMD_WIDTH = 8;
+
+struct SimdFloat { float v[SIMD_WIDTH]; };
+struct SimdMask { bool m[SIMD_WIDTH]; };
+
+#define SIMD_LANES_(expr)   for (size_t i = 0; i < SIMD_WIDTH; ++i) { expr; }
+
+inline SimdFloat    simdLoad(const float* p) { SimdFloat r; SIMD_LANES_(r.v[i] = p[i]); return r; }
+inline void         simdStore(float* p, SimdFloat a) { SIMD_LANES_(p[i] = a.v[i]); }
+inline SimdFloat    simdSet(float f) { SimdFloat r; SIMD_LANES_(r.v[i] = f); return r; }
+inline SimdFloat    simdLoadU16(const uint16_t* p) { SimdFloat r; SIMD_LANES_(r.v[i] = float(p[i])); return r; }
+inline SimdFloat    simdGather(const float* base, const int32_t* offsets) { SimdFloat r; SIMD_LANES_(r.v[i] = base[offsets[i]]); return r; }
+
+inline SimdFloat    operator + (SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] + b.v[i]); return r; }
+inline SimdFloat    operator - (SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] - b.v[i]); return r; }
+inline SimdFloat    operator * (SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] * b.v[i]); return r; }
+inline SimdFloat    operator / (SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] / b.v[i]); return r; }
+
+inline SimdMask     operator <  (SimdFloat a, SimdFloat b) { SimdMask r; SIMD_LANES_(r.m[i] = a.v[i] < b.v[i]); return r; }
+inline SimdMask     operator <= (SimdFloat a, SimdFloat b) { SimdMask r; SIMD_LANES_(r.m[i] = a.v[i] <= b.v[i]); return r; }
+inline SimdMask     operator >= (SimdFloat a, SimdFloat b) { SimdMask r; SIMD_LANES_(r.m[i] = a.v[i] >= b.v[i]); return r; }
+inline SimdMask     operator & (SimdMask a, SimdMask b) { SimdMask r; SIMD_LANES_(r.m[i] = a.m[i] && b.m[i]); return r; }
+
+inline SimdFloat    simdMin(SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]); return r; }
+inline SimdFloat    simdMax(SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]); return r; }
+inline SimdFloat    simdSelect(SimdMask m, SimdFloat a, SimdFloat b) { SimdFloat r; SIMD_LANES_(r.v[i] = m.m[i] ? a.v[i] : b.v[i]); return r; }
+
+inline float        simdHMin(SimdFloat a) { float r = a.v[0]; SIMD_LANES_(r = a.v[i] < r ? a.v[i] : r); return r; }
+
+#undef SIMD_LANES_
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// 8 lanes whatever SIMD_WIDTH is (AVX for both the AVX2 and AVX-512 builds): the wide BVH node children
+#if defined(__AVX512F__) || defined(__AVX2__)
+
+struct SimdFloat8 { __m256 v; };
+
+inline SimdFloat8   simdLoad8(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline void         simdStore(float* p, SimdFloat8 a) { _mm256_storeu_ps(p, a.v); }
+inline SimdFloat8   simdSet8(float f) { return { _mm256_set1_ps(f) }; }
+inline SimdFloat8   simdLoadU8x8(const uint8_t* p) { return { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))) }; }
+
+inline SimdFloat8   operator + (SimdFloat8 a, SimdFloat8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline SimdFloat8   operator - (SimdFloat8 a, SimdFloat8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline SimdFloat8   operator * (SimdFloat8 a, SimdFloat8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+
+inline SimdFloat8   simdMin(SimdFloat8 a, SimdFloat8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline SimdFloat8   simdMax(SimdFloat8 a, SimdFloat8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+
+#else
+
+struct SimdFloat8 { float v[8]; };
+
+#define SIMD_LANES8_(expr)  for (size_t i = 0; i < 8; ++i) { expr; }
+
+inline SimdFloat8   simdLoad8(const float* p) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = p[i]); return r; }
+inline void         simdStore(float* p, SimdFloat8 a) { SIMD_LANES8_(p[i] = a.v[i]); }
+inline SimdFloat8   simdSet8(float f) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = f); return r; }
+inline SimdFloat8   simdLoadU8x8(const uint8_t* p) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = float(p[i])); return r; }
+
+inline SimdFloat8   operator + (SimdFloat8 a, SimdFloat8 b) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = a.v[i] + b.v[i]); return r; }
+inline SimdFloat8   operator - (SimdFloat8 a, SimdFloat8 b) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = a.v[i] - b.v[i]); return r; }
+inline SimdFloat8   operator * (SimdFloat8 a, SimdFloat8 b) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = a.v[i] * b.v[i]); return r; }
+
+inline SimdFloat8   simdMin(SimdFloat8 a, SimdFloat8 b) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]); return r; }
+inline SimdFloat8   simdMax(SimdFloat8 a, SimdFloat8 b) { SimdFloat8 r; SIMD_LANES8_(r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]); return r; }
+
+#undef SIMD_LANES8_
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// single lane versions
+inline float        simdMin(float a, float b) { return a < b ? a : b; }
+inline float        simdMax(float a, float b) { return a > b ? a : b; }
+inline float        simdSelect(bool m, float a, float b) { return m ? a : b; }
+
+// constant broadcast for kernels written as templates over float/SimdFloat
+template<typename F> inline F   simdConst(float f);
+template<> inline float         simdConst<float>(float f) { return f; }
+template<> inline SimdFloat     simdConst<SimdFloat>(float f) { return simdSet(f); }
+
+////////////////////////////////////////////////////////////////////////////////
+// std::vector allocator for aligned pools (the C++11 allocator only guarantees the alignment of the fundamental types)
+template<typename T, size_t ALIGNMENT>
+struct AlignedAllocator {
+    typedef T   value_type;
+
+    template<typename U> struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+    AlignedAllocator() {}
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&) {}
+
+    // over allocate, the raw pointer is kept just before the aligned block
+    T* allocate(size_t n) {
+        auto raw = ::operator new(n * sizeof(T) + ALIGNMENT + sizeof(void*));
+        auto aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + ALIGNMENT - 1) & ~uintptr_t(ALIGNMENT - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, size_t) { ::operator delete(reinterpret_cast<void**>(p)[-1]); }
+};
+
+template<typename T, typename U, size_t ALIGNMENT> inline bool operator == (const AlignedAllocator<T, ALIGNMENT>&, const AlignedAllocator<U, ALIGNMENT>&) { return true; }
+template<typename T, typename U, size_t ALIGNMENT> inline bool operator != (const AlignedAllocator<T, ALIGNMENT>&, const AlignedAllocator<U, ALIGNMENT>&) { return false; }
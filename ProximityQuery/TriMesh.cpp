@@ -18,6 +18,14 @@
 #include "TriMesh.hpp"
 
 #include <iostream>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <fstream>
 
 using namespace std;
 using namespace glm;
@@ -43,18 +51,23 @@ Segment::closestPointOnSegment(const Segment& s, const glm::vec3& pt) {
 // Classic Graphcis Gems 2 : sphere/box intersection
 bool
 AABB::intersectSphere(const AABB& bbox, const glm::vec3& center, float radius) {
+    return radius * radius > sqDistance(bbox, center);
+}
+
+float
+AABB::sqDistance(const AABB& bbox, const glm::vec3& pt) {
     auto dist = 0.0f;
 
-    if (center.x < bbox.min_.x) { dist += sqr_(center.x - bbox.min_.x); }
-    else if (center.x > bbox.max_.x) { dist += sqr_(center.x - bbox.max_.x); }
+    if (pt.x < bbox.min_.x) { dist += sqr_(pt.x - bbox.min_.x); }
+    else if (pt.x > bbox.max_.x) { dist += sqr_(pt.x - bbox.max_.x); }
 
-    if (center.y < bbox.min_.y) { dist += sqr_(center.y - bbox.min_.y); }
-    else if (center.y > bbox.max_.y) { dist += sqr_(center.y - bbox.max_.y); }
+    if (pt.y < bbox.min_.y) { dist += sqr_(pt.y - bbox.min_.y); }
+    else if (pt.y > bbox.max_.y) { dist += sqr_(pt.y - bbox.max_.y); }
 
-    if (center.z < bbox.min_.z) { dist += sqr_(center.z - bbox.min_.z); }
-    else if (center.z > bbox.max_.z) { dist += sqr_(center.z - bbox.max_.z); }
+    if (pt.z < bbox.min_.z) { dist += sqr_(pt.z - bbox.min_.z); }
+    else if (pt.z > bbox.max_.z) { dist += sqr_(pt.z - bbox.max_.z); }
 
-    return radius * radius > dist;
+    return dist;
 }
 
 static ivec3 cubeTable[8] = {
@@ -88,67 +101,152 @@ AABB::subdivide(const AABB& bbox, std::vector<AABB>& outBoxes) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+//
+// closest point on a triangle, written for SIMD lanes: no branches, every lane computes all the candidates
+// - the projection on the triangle plane, valid when its barycentric coordinates are inside the triangle
+// - the closest point on each edge (clamped segment projection)
+// the result is the squared distance and the closest point coordinates (s, t) along the edges ab and ac
+//
+// Everything that only depends on the triangle is precomputed once in a record (TriRecordL), a query
+// is then only multiply-adds: no matrix inversion, no division and no square root.
+//
+template<typename F>
+struct Vec3L {
+    F   x, y, z;
+};
 
-///
-/// get the closest point on tri
-///
-glm::vec3
-TriMesh::Tri::closestOnTri(const Tri& tri, const glm::vec3& pt) {
-
-    auto v0 = tri.v[0].position;
-    auto v1 = tri.v[1].position;
-    auto v2 = tri.v[2].position;
+template<typename F> static inline Vec3L<F>  operator - (const Vec3L<F>& a, const Vec3L<F>& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+template<typename F> static inline Vec3L<F>  operator * (const Vec3L<F>& a, F s) { return { a.x * s, a.y * s, a.z * s }; }
+template<typename F> static inline F         dot(const Vec3L<F>& a, const Vec3L<F>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+template<typename F> static inline F         clamp01(F f) { return simdMin(simdMax(f, simdConst<F>(0.0f)), simdConst<F>(1.0f)); }
+
+template<typename F>
+struct TriRecordL {
+    Vec3L<F>    a;          // origin
+    Vec3L<F>    ab;         // edge vectors
+    Vec3L<F>    ac;
+    F           d00;        // ab.ab
+    F           d01;        // ab.ac
+    F           d11;        // ac.ac
+    F           invDenom;   // 1 / (d00 * d11 - d01^2), NaN for degenerate triangles: the inside test always fails
+    F           invD00;     // 1 / |ab|^2, 0 for a degenerate edge
+    F           invD11;     // 1 / |ac|^2
+    F           invBC;      // 1 / |bc|^2
+};
 
-    //
-    // the good stuff is here :) solve it using coordinate systems
-    //
+static_assert(sizeof(TriRecordL<float>) == CollisionMesh::BLOCK_STREAMS * sizeof(float), "a record must map to the block streams");
+
+// also the SIMD version for the QUANTIZED leaves, the records are rebuilt from the positions at query time
+template<typename F>
+static inline TriRecordL<F>
+makeRecordL(const Vec3L<F>& v0, const Vec3L<F>& v1, const Vec3L<F>& v2) {
+    auto zero = simdConst<F>(0.0f);
+    auto one = simdConst<F>(1.0f);
+    auto bc = v2 - v1;
+
+    TriRecordL<F> r;
+    r.a = v0;
+    r.ab = v1 - v0;
+    r.ac = v2 - v0;
+    r.d00 = dot(r.ab, r.ab);
+    r.d01 = dot(r.ab, r.ac);
+    r.d11 = dot(r.ac, r.ac);
+
+    // the divisions by 0 are computed and discarded
+    auto denom = r.d00 * r.d11 - r.d01 * r.d01;
+    auto sqBC = dot(bc, bc);
+    r.invDenom = simdSelect(zero < denom, one / denom, simdConst<F>(std::numeric_limits<float>::quiet_NaN()));
+    r.invD00 = simdSelect(zero < r.d00, one / r.d00, zero);
+    r.invD11 = simdSelect(zero < r.d11, one / r.d11, zero);
+    r.invBC = simdSelect(zero < sqBC, one / sqBC, zero);
+    return r;
+}
 
-    // center coordinate system around v0
-    auto X = v1 - v0;
-    auto Y = v2 - v0;
-    auto Z = cross(X, Y); // create the 3rd axis
-    auto baryCoords = inverse(mat3(X, Y, Z)) * (pt - v0);  // get the barycentric coordinates
+static inline TriRecordL<float>
+makeRecord(const vec3& v0, const vec3& v1, const vec3& v2) {
+    return makeRecordL<float>({ v0.x, v0.y, v0.z }, { v1.x, v1.y, v1.z }, { v2.x, v2.y, v2.z });
+}
 
-    // reject the last component
-    auto u = baryCoords.x, v = baryCoords.y;
+template<typename F>
+static inline F
+sqDistToTri(const TriRecordL<F>& r, const Vec3L<F>& p, F& s, F& t) {
+    auto zero = simdConst<F>(0.0f);
+    auto one = simdConst<F>(1.0f);
+
+    auto ap = p - r.a;
+    auto d20 = dot(ap, r.ab);
+    auto d21 = dot(ap, r.ac);
+
+    // plane projection
+    auto fs = (r.d11 * d20 - r.d01 * d21) * r.invDenom;
+    auto ft = (r.d00 * d21 - r.d01 * d20) * r.invDenom;
+    auto inside = (fs >= zero) & (ft >= zero) & (fs + ft <= one);
+    auto fd = ap - r.ab * fs - r.ac * ft;
+
+    // edges ab (t = 0), ac (s = 0) and bc (s = 1 - u, t = u)
+    auto sAB = clamp01(d20 * r.invD00);
+    auto tAC = clamp01(d21 * r.invD11);
+    auto uBC = clamp01((d21 - d20 - r.d01 + r.d00) * r.invBC);
+
+    auto dAB = ap - r.ab * sAB;
+    auto dAC = ap - r.ac * tAC;
+    auto dBC = ap - r.ab * (one - uBC) - r.ac * uBC;
+
+    auto sqDist = dot(dAB, dAB);
+    s = sAB;
+    t = zero;
+
+    auto sqDistAC = dot(dAC, dAC);
+    auto closer = sqDistAC < sqDist;
+    sqDist = simdSelect(closer, sqDistAC, sqDist);
+    s = simdSelect(closer, zero, s);
+    t = simdSelect(closer, tAC, t);
+
+    auto sqDistBC = dot(dBC, dBC);
+    closer = sqDistBC < sqDist;
+    sqDist = simdSelect(closer, sqDistBC, sqDist);
+    s = simdSelect(closer, one - uBC, s);
+    t = simdSelect(closer, uBC, t);
+
+    s = simdSelect(inside, fs, s);
+    t = simdSelect(inside, ft, t);
+    return simdSelect(inside, dot(fd, fd), sqDist);
+}
 
-    if (u > 0.0f && u < 1.0f &&
-        v > 0.0f && v < 1.0f &&
-        u + v < 1.0f) { // inside triangle!
-        return v0 + X * u + Y * v;
-    } else {  // out of triangle, fall on segments
-        auto ps0 = Segment::closestPointOnSegment(Segment(v0, v1), pt);
-        auto ps1 = Segment::closestPointOnSegment(Segment(v1, v2), pt);
-        auto ps2 = Segment::closestPointOnSegment(Segment(v2, v0), pt);
+static inline vec3
+pointOnRecord(const TriRecordL<float>& r, float s, float t) {
+    return vec3(r.a.x + s * r.ab.x + t * r.ac.x, r.a.y + s * r.ab.y + t * r.ac.y, r.a.z + s * r.ab.z + t * r.ac.z);
+}
 
-        auto l0 = glm::length(pt - ps0);
-        auto l1 = glm::length(pt - ps1);
-        auto l2 = glm::length(pt - ps2);
+////////////////////////////////////////////////////////////////////////////////
 
-	auto minDistance = glm::min(l0, glm::min(l1, l2));
+///
+/// get the closest point on tri
+///
+glm::vec3
+TriMesh::Tri::closestOnTri(const Tri& tri, const glm::vec3& pt) {
+    auto r = makeRecord(tri.v[0].position, tri.v[1].position, tri.v[2].position);
 
-        if (l0 == minDistance) return ps0;
-        if (l1 == minDistance) return ps1;
-        return ps2;
-    }
+    float s, t;
+    sqDistToTri(r, { pt.x, pt.y, pt.z }, s, t);
+    return pointOnRecord(r, s, t);
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 glm::vec3
-TriMesh::closestOnMesh(TriMesh::Ptr mesh, const glm::vec3& pt) {
-    auto minDistance = std::numeric_limits<float>::max();
+TriMesh::closestOnMesh(const TriMesh& mesh, const glm::vec3& pt) {
+    auto minSqDistance = std::numeric_limits<float>::max();
     auto minPoint = vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
 
-    auto tris = mesh->tris();
-
     // loop through all triangles and find the closest point
-    for (auto t : tris) {
+    for (const auto& t : mesh.tris()) {
         auto mTemp = Tri::closestOnTri(t, pt);
-        if (glm::length(pt - mTemp) < minDistance) {
+        auto d = pt - mTemp;
+        if (glm::dot(d, d) < minSqDistance) {
             minPoint = mTemp;
-            minDistance = glm::length(pt - mTemp);
+            minSqDistance = glm::dot(d, d);
         }
     }
 
@@ -156,189 +254,3046 @@ TriMesh::closestOnMesh(TriMesh::Ptr mesh, const glm::vec3& pt) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-struct BvhTri {
-    TriMesh::Tri    tri;
-    AABB            box;
-    BvhTri(const TriMesh::Tri& t) : tri(t), box(TriMesh::Tri::boundingBox(tri)) {}
+// hash of the first bytes of a vertex (FNV-1a over the 32 bits words), the floats are compared bit for bit
+static inline uint32_t
+hashVertex(const IndexedTriMesh::Vertex& v, size_t keyBytes) {
+    uint32_t words[sizeof(IndexedTriMesh::Vertex) / 4];
+    memcpy(words, &v, keyBytes);
+
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < keyBytes / 4; ++i) {
+        h = (h ^ words[i]) * 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+IndexedTriMesh::Ptr
+IndexedTriMesh::create(std::vector<Vertex>&& vertices, std::vector<uint32_t>&& indices, Weld weld) {
+    if (indices.size() % 3 != 0) {
+        cerr << "Error: the index count of an indexed mesh must be a multiple of 3" << endl;
+        return nullptr;
+    }
+
+    for (auto i : indices) {
+        if (i >= vertices.size()) {
+            cerr << "Error: indexed mesh vertex " << i << " out of range" << endl;
+            return nullptr;
+        }
+    }
+
+    if (weld != Weld::NONE) {
+        size_t keyBytes = weld == Weld::POSITIONS ? sizeof(glm::vec3) : sizeof(Vertex);
+
+        //
+        // open addressing table of the kept vertices (index + 1, 0 is free), at most half full:
+        // - remap is the kept vertex of every input vertex, the unused vertices are dropped
+        //
+        size_t slotCount = 16;
+        while (slotCount < vertices.size() * 2) slotCount *= 2;
+
+        vector<uint32_t> slots(slotCount, 0);
+        vector<uint32_t> remap(vertices.size(), std::numeric_limits<uint32_t>::max());
+        vector<Vertex> welded;
+
+        for (auto& i : indices) {
+            if (remap[i] == std::numeric_limits<uint32_t>::max()) {
+                const auto& v = vertices[i];
+                auto s = hashVertex(v, keyBytes) & (slotCount - 1);
+                while (slots[s] != 0 && memcmp(&welded[slots[s] - 1], &v, keyBytes) != 0) {
+                    s = (s + 1) & (slotCount - 1);
+                }
+
+                if (slots[s] == 0) {
+                    welded.push_back(v);
+                    slots[s] = uint32_t(welded.size());
+                }
+                remap[i] = slots[s] - 1;
+            }
+            i = remap[i];
+        }
+
+        vertices.swap(welded);
+    }
+
+    glm::vec3 mn(std::numeric_limits<float>::max());
+    glm::vec3 mx(-std::numeric_limits<float>::max());
+    for (const auto& v : vertices) {
+        mn = glm::min(mn, v.position);
+        mx = glm::max(mx, v.position);
+    }
+
+    return Ptr(new IndexedTriMesh(std::move(vertices), std::move(indices), AABB(mn, mx)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// parallel build:
+// - subtrees with enough triangles are built as tasks on their own thread, as long as the thread budget allows it
+// - the linear passes over big triangle sets (bounds, counting, partitioning) are split in chunks
+// - each task/chunk writes to its own slot and the slots are merged in a fixed order,
+//   so the output is the same whatever the thread count is
+//
+static const size_t PARALLEL_TASK_GRAIN = 4096;     // min triangle count to build a subtree on another thread
+static const size_t PARALLEL_PASS_GRAIN = 65536;    // min triangle count per chunk of a linear pass
+
+struct BuildContext {
+    size_t                  maxTriCountHint;
+    size_t                  threadCount;
+    std::atomic<size_t>     spareThreads;
+
+    BuildContext(size_t maxTriCountHint, size_t threadCount) : maxTriCountHint(maxTriCountHint), threadCount(threadCount), spareThreads(threadCount - 1) {}
+
+    bool acquireThread() {
+        auto spare = spareThreads.load();
+        while (spare > 0) {
+            if (spareThreads.compare_exchange_weak(spare, spare - 1)) return true;
+        }
+        return false;
+    }
+
+    void releaseThread() { ++spareThreads; }
+
+    // chunk count for a linear pass over count elements
+    size_t chunkCount(size_t count) const { return std::max<size_t>(1, std::min(threadCount, count / PARALLEL_PASS_GRAIN)); }
 };
 
+// fn(chunk, begin, end) for chunkCount chunks covering [0, count), chunk 0 runs on the calling thread
+template<typename Fn>
+static void
+parallelFor(size_t chunkCount, size_t count, Fn fn) {
+    vector<std::thread> threads;
+    for (size_t c = 1; c < chunkCount; ++c) {
+        threads.push_back(std::thread(fn, c, count * c / chunkCount, count * (c + 1) / chunkCount));
+    }
+
+    fn(0, 0, count / chunkCount);
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// flat builders:
+// - a single array of 32 bits triangle ids is partitioned in place, every node owns a range of it
+// - the triangle boxes are computed once and looked up by id, the triangles are only copied into the final leaves
+// - the root comes first and every node reserves the contiguous block of its children in the flat node array (see FlatTree),
+//   a leaf indexes a range of ids
+//
+struct IdRange {
+    uint32_t    begin;
+    uint32_t    end;
+};
 
-struct BvhNode {
-    typedef shared_ptr<BvhNode> Ptr;
+//
+// AABBNode : what is going to be called lvariant in C++1z (algeabric data type), the build time node
+// - compact: the box, the type and a 32 bits index, two nodes per 64 bytes cache line
+// - sparse: a node only has its populated children (up to 8), stored contiguously from firstChild.
+//   The child mask tells which octants/slots they occupy
+// - collapsed into WideNode once the tree is complete
+//
+struct AABBNode {
+    enum class Type : uint8_t {
+        NODE,
+        LEAF
+    };
+
+    const AABB& bbox() const { return bbox_; }
+    Type        type() const { return type_; }
+
+    struct Node;
+    struct Leaf;
+
+protected:
+    AABBNode(const AABB& bbox, Type type) : bbox_(bbox), type_(type), childMask_(0), childCount_(0), reserved_(0), index_(0) {}
+
+    AABB        bbox_;
+    Type        type_;
+    uint8_t     childMask_;
+    uint8_t     childCount_;
+    uint8_t     reserved_;
+    uint32_t    index_;     // first child or leaf index
+};
 
-    bool                isLeaf;
-    AABB                box;
+static_assert(sizeof(AABBNode) == 32, "two nodes must fit a cache line");
 
-    std::vector<BvhTri> tris;   // 0 indicates node, > 0 indicates leaf
-    std::vector<BvhNode::Ptr>    children;
+struct AABBNode::Node : public AABBNode {
+    Node(const AABB& bbox, size_t firstChild, size_t childCount, uint32_t childMask) : AABBNode(bbox, Type::NODE) {
+        index_ = uint32_t(firstChild);
+        childCount_ = uint8_t(childCount);
+        childMask_ = uint8_t(childMask);
+    }
 
-    BvhNode(bool isLeaf, const AABB& box, const std::vector<BvhTri>& tris) : isLeaf(isLeaf), box(box), tris(tris) {}
-    BvhNode(bool isLeaf, const AABB& box, const std::vector<BvhNode::Ptr>& children) : isLeaf(isLeaf), box(box), children(children) {}
+    uint32_t    firstChild() const { return index_; }
+    uint32_t    childCount() const { return childCount_; }
+    uint32_t    childMask() const { return childMask_; }
+};
 
-    static BvhNode::Ptr subdivide(const std::vector<BvhTri>& tris, size_t maxTriCountHint);
+struct AABBNode::Leaf : public AABBNode {
+    Leaf(const AABB& bbox, size_t triMesh) : AABBNode(bbox, Type::LEAF) {
+        index_ = uint32_t(triMesh);
+    }
 
-    static size_t       mapToAABBNodes(BvhNode::Ptr node, std::vector<AABBNode>& nodes, std::vector<TriMesh::Ptr>& leaves);
+    uint32_t    triMesh() const { return index_; }
 };
 
-BvhNode::Ptr
-BvhNode::subdivide(const std::vector<BvhTri>& tris, size_t maxTriCountHint) {
-    auto minTs = glm::vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    auto maxTs = glm::vec3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+static inline AABB
+emptyBox() {
+    return AABB(vec3(std::numeric_limits<float>::max()), vec3(-std::numeric_limits<float>::max()));
+}
+
+static inline vec3
+centroid(const AABB& box) {
+    return (box.min() + box.max()) * 0.5f;
+}
+
+//
+// the children of a node are a contiguous block: a node reserves the block of its children, then each child
+// fills its slot and reserves its own children after the blocks of its older siblings' subtrees
+//
+struct FlatTree {
+    vector<AABBNode>    nodes;
+    vector<IdRange>     leaves;
+
+    size_t reserve(size_t count) {
+        auto first = nodes.size();
+        nodes.resize(first + count, AABBNode::Leaf(emptyBox(), 0));
+        return first;
+    }
+
+    void leaf(size_t slot, const AABB& box, size_t begin, size_t end) {
+        leaves.push_back({ uint32_t(begin), uint32_t(end) });
+        nodes[slot] = AABBNode::Leaf(box, leaves.size() - 1);
+    }
 
-    for (auto t : tris) {
-        minTs = glm::min(minTs, t.box.min());
-        maxTs = glm::max(maxTs, t.box.max());
+    void node(size_t slot, const AABB& box, size_t firstChild, size_t childCount, uint32_t childMask) {
+        nodes[slot] = AABBNode::Node(box, firstChild, childCount, childMask);
     }
 
-    auto allTrisBox = AABB(minTs, maxTs);
+    // appends a subtree built apart (root at 0), its root goes to slot
+    void append(size_t slot, const FlatTree& sub) {
+        auto nodeOffset = nodes.size() - 1;     // the sub nodes but the root follow the current ones
+        auto leafOffset = leaves.size();
 
-    if (tris.size() > maxTriCountHint) {    // the tri count still exceeds the max limit hint
-        vector<AABB> outBoxes;
-        AABB::subdivide(allTrisBox, outBoxes);
+        leaves.insert(leaves.end(), sub.leaves.begin(), sub.leaves.end());
 
-        // 1st pass - count the number of triangles included in each box,
-        // if any box intersects all triangles then we have reached the limit and allTrisBox is a leaf
-        size_t tCount[8] = { 0 };
-        for (auto t : tris) {
-            for (size_t i = 0; i < outBoxes.size(); ++i ) {
-                if (AABB::overlap(outBoxes[i], t.box)) ++tCount[i];
+        auto remap = [&](const AABBNode& n) -> AABBNode {
+            if (n.type() == AABBNode::Type::LEAF) {
+                return AABBNode::Leaf(n.bbox(), static_cast<const AABBNode::Leaf&>(n).triMesh() + leafOffset);
             }
+            const auto& node = static_cast<const AABBNode::Node&>(n);
+            return AABBNode::Node(n.bbox(), node.firstChild() + nodeOffset, node.childCount(), node.childMask());
+        };
+
+        nodes[slot] = remap(sub.nodes[0]);
+        for (size_t i = 1; i < sub.nodes.size(); ++i) {
+            nodes.push_back(remap(sub.nodes[i]));
         }
+    }
+};
 
-        for (auto tc : tCount) {
-            if (tc == tris.size()) {    // one of them has all the triangles, bail!
-                return Ptr(new BvhNode(true, allTrisBox, tris));
-            }
+struct FlatBuilder {
+    typedef void (FlatBuilder::*BuildFn)(FlatTree& tree, size_t slot, size_t begin, size_t end, size_t depth);
+
+    BuildContext&           ctx;
+    const vector<AABB>&     boxes;      // triangle boxes, by triangle id
+    vector<uint32_t>&       ids;
+    vector<uint32_t>&       scratch;    // same size as ids, a node only uses its own range
+
+    FlatBuilder(BuildContext& ctx, const vector<AABB>& boxes, vector<uint32_t>& ids, vector<uint32_t>& scratch) : ctx(ctx), boxes(boxes), ids(ids), scratch(scratch) {}
+
+    AABB    bounds(size_t begin, size_t end) const;
+    void    buildChildren(BuildFn build, FlatTree& tree, const IdRange* ranges, size_t count, size_t depth, size_t firstChild);
+
+    void    octree(FlatTree& tree, size_t slot, size_t begin, size_t end, size_t depth);
+    size_t  splitSAH(size_t begin, size_t end);
+    void    sah(FlatTree& tree, size_t slot, size_t begin, size_t end, size_t depth);
+};
+
+AABB
+FlatBuilder::bounds(size_t begin, size_t end) const {
+    auto chunkCount = ctx.chunkCount(end - begin);
+
+    vector<AABB> chunkBoxes(chunkCount, emptyBox());
+    parallelFor(chunkCount, end - begin, [&](size_t c, size_t b, size_t e) {
+        for (size_t i = begin + b; i < begin + e; ++i) {
+            chunkBoxes[c] = AABB::merge(chunkBoxes[c], boxes[ids[i]]);
         }
+    });
 
-        // 2nd pass - sort the triangles into their respective boxes
-        // rule: one triangle can belong to only one box
-        vector<BvhTri> boxTris[8];
+    auto box = emptyBox();
+    for (const auto& b : chunkBoxes) {
+        box = AABB::merge(box, b);
+    }
+    return box;
+}
 
-        for (auto t : tris) {
-            if (AABB::overlap(outBoxes[0], t.box)) boxTris[0].push_back(t);
-            else if (AABB::overlap(outBoxes[1], t.box)) boxTris[1].push_back(t);
-            else if (AABB::overlap(outBoxes[2], t.box)) boxTris[2].push_back(t);
-            else if (AABB::overlap(outBoxes[3], t.box)) boxTris[3].push_back(t);
-            else if (AABB::overlap(outBoxes[4], t.box)) boxTris[4].push_back(t);
-            else if (AABB::overlap(outBoxes[5], t.box)) boxTris[5].push_back(t);
-            else if (AABB::overlap(outBoxes[6], t.box)) boxTris[6].push_back(t);
-            else if (AABB::overlap(outBoxes[7], t.box)) boxTris[7].push_back(t);
+// big children are built on their own thread into their own tree and appended in child order,
+// which gives the same layout as building them in place
+void
+FlatBuilder::buildChildren(BuildFn build, FlatTree& tree, const IdRange* ranges, size_t count, size_t depth, size_t firstChild) {
+    FlatTree subTrees[8];
+    std::thread tasks[8];
+
+    for (size_t i = 0; i < count; ++i) {
+        if (ranges[i].end - ranges[i].begin >= PARALLEL_TASK_GRAIN && ctx.acquireThread()) {
+            tasks[i] = std::thread([this, build, &subTrees, ranges, i, depth]() {
+                subTrees[i].reserve(1);
+                (this->*build)(subTrees[i], 0, ranges[i].begin, ranges[i].end, depth + 1);
+                ctx.releaseThread();
+            });
         }
+    }
 
-        // 3rd pass - build the node recursively
-        vector<Ptr> children;
-        for (size_t i = 0; i < 8; ++i) {
-            children.push_back(subdivide(boxTris[i], maxTriCountHint));
+    for (size_t i = 0; i < count; ++i) {
+        if (tasks[i].joinable()) {
+            tasks[i].join();
+            tree.append(firstChild + i, subTrees[i]);
+        } else {
+            (this->*build)(tree, firstChild + i, ranges[i].begin, ranges[i].end, depth + 1);
         }
+    }
+}
 
-        return Ptr(new BvhNode(false, allTrisBox, children));
-    } else {
-        return Ptr(new BvhNode(true, allTrisBox, tris));
+// rule: one triangle can belong to only one box, the first one it overlaps
+static inline size_t
+octant(const vector<AABB>& outBoxes, const AABB& box) {
+    for (size_t i = 0; i < 7; ++i) {
+        if (AABB::overlap(outBoxes[i], box)) return i;
     }
+    return 7;
 }
 
-float
-frand() {
-    return (float(rand() & 0xFFFF) / float(0x10000));
+void
+FlatBuilder::octree(FlatTree& tree, size_t slot, size_t begin, size_t end, size_t depth) {
+    auto count = end - begin;
+    auto box = bounds(begin, end);
+
+    if (count <= ctx.maxTriCountHint || depth >= CollisionMesh::MAX_DEPTH) {   // the tri count is within the max limit hint
+        tree.leaf(slot, box, begin, end);
+        return;
+    }
+
+    vector<AABB> outBoxes;
+    AABB::subdivide(box, outBoxes);
+
+    // 1st pass - count the number of triangles overlapping each box and the octant each triangle goes to,
+    // if any box intersects all triangles then we have reached the limit and box is a leaf
+    auto chunkCount = ctx.chunkCount(count);
+    vector<size_t> chunkOverlaps(chunkCount * 8, 0);
+    vector<size_t> chunkOffsets(chunkCount * 8, 0);
+
+    parallelFor(chunkCount, count, [&](size_t c, size_t b, size_t e) {
+        for (size_t t = begin + b; t < begin + e; ++t) {
+            const auto& triBox = boxes[ids[t]];
+            for (size_t i = 0; i < 8; ++i) {
+                if (AABB::overlap(outBoxes[i], triBox)) ++chunkOverlaps[c * 8 + i];
+            }
+            ++chunkOffsets[c * 8 + octant(outBoxes, triBox)];
+        }
+    });
+
+    for (size_t i = 0; i < 8; ++i) {
+        size_t overlaps = 0;
+        for (size_t c = 0; c < chunkCount; ++c) {
+            overlaps += chunkOverlaps[c * 8 + i];
+        }
+
+        if (overlaps == count) {    // one of them has all the triangles, bail!
+            tree.leaf(slot, box, begin, end);
+            return;
+        }
+    }
+
+    // 2nd pass - scatter the ids to their octant through the scratch range and copy them back,
+    // octant major, chunk minor: the triangles keep their relative order
+    IdRange ranges[8];
+    size_t offset = begin;
+    for (size_t i = 0; i < 8; ++i) {
+        ranges[i].begin = uint32_t(offset);
+        for (size_t c = 0; c < chunkCount; ++c) {
+            auto n = chunkOffsets[c * 8 + i];
+            chunkOffsets[c * 8 + i] = offset;
+            offset += n;
+        }
+        ranges[i].end = uint32_t(offset);
+    }
+
+    parallelFor(chunkCount, count, [&](size_t c, size_t b, size_t e) {
+        auto offsets = &chunkOffsets[c * 8];
+        for (size_t t = begin + b; t < begin + e; ++t) {
+            scratch[offsets[octant(outBoxes, boxes[ids[t]])]++] = ids[t];
+        }
+    });
+
+    parallelFor(chunkCount, count, [&](size_t, size_t b, size_t e) {
+        std::copy(scratch.begin() + begin + b, scratch.begin() + begin + e, ids.begin() + begin + b);
+    });
+
+    // 3rd pass - build the node recursively, the empty octants are left out
+    IdRange children[8];
+    size_t childCount = 0;
+    uint32_t childMask = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        if (ranges[i].end > ranges[i].begin) {
+            children[childCount++] = ranges[i];
+            childMask |= 1u << i;
+        }
+    }
+
+    auto firstChild = tree.reserve(childCount);
+    buildChildren(&FlatBuilder::octree, tree, children, childCount, depth, firstChild);
+
+    tree.node(slot, box, firstChild, childCount, childMask);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// binned SAH builder:
+// - the triangle centroids are binned along each axis and the split minimizing
+//   area(left) * count(left) + area(right) * count(right) is chosen
+// - to keep the 8 children node layout, the cluster with the most triangles is split until there are 8 clusters
+//   (or nothing can be split anymore)
+//
+static const size_t SAH_BIN_COUNT = 16;
+
+// partitions [begin, end) and returns the split position, or begin if no split beats the unsplit cluster
 size_t
-BvhNode::mapToAABBNodes(BvhNode::Ptr node, std::vector<AABBNode>& nodes, std::vector<TriMesh::Ptr>& leaves) {
-    if (node->isLeaf) {
-        vector<TriMesh::Tri> tris;
-        auto color = vec4(frand(), frand(), frand(), 0.0f);
-        for (auto bt : node->tris) {
-            TriMesh::Tri tmp = bt.tri;
-            tmp.v[0].color = tmp.v[1].color = tmp.v[2].color = color;   // for debugging purposes
-            tris.push_back(tmp);
-        }
-
-        leaves.push_back(TriMesh::Ptr(new TriMesh(tris)));
-        nodes.push_back(AABBNode::Leaf(node->box, leaves.size() - 1, color));
-    } else {
-        int idx = 0;
-        size_t bIds[8] = { 0 };
-        for (auto ch : node->children) {
-            bIds[idx] = mapToAABBNodes(ch, nodes, leaves);
-            ++idx;
+FlatBuilder::splitSAH(size_t begin, size_t end) {
+    auto cMin = vec3(std::numeric_limits<float>::max());
+    auto cMax = vec3(-std::numeric_limits<float>::max());
+    auto box = emptyBox();
+    for (size_t i = begin; i < end; ++i) {
+        const auto& triBox = boxes[ids[i]];
+        cMin = glm::min(cMin, centroid(triBox));
+        cMax = glm::max(cMax, centroid(triBox));
+        box = AABB::merge(box, triBox);
+    }
+
+    auto bestCost = AABB::area(box) * float(end - begin);
+    int bestAxis = -1;
+    size_t bestBin = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        auto extent = cMax[axis] - cMin[axis];
+        if (extent <= 0.0f) continue;
+
+        auto scale = float(SAH_BIN_COUNT) / extent;
+
+        AABB binBoxes[SAH_BIN_COUNT] = { emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox()
+                                       , emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox(), emptyBox() };
+        size_t binCounts[SAH_BIN_COUNT] = { 0 };
+
+        for (size_t i = begin; i < end; ++i) {
+            const auto& triBox = boxes[ids[i]];
+            auto bin = std::min(size_t((centroid(triBox)[axis] - cMin[axis]) * scale), SAH_BIN_COUNT - 1);
+            binBoxes[bin] = AABB::merge(binBoxes[bin], triBox);
+            ++binCounts[bin];
+        }
+
+        // right to left sweep for the right side areas, then left to right to evaluate the splits
+        float rightAreas[SAH_BIN_COUNT];
+        size_t rightCounts[SAH_BIN_COUNT];
+        auto right = emptyBox();
+        size_t rightCount = 0;
+        for (size_t b = SAH_BIN_COUNT - 1; b > 0; --b) {
+            right = AABB::merge(right, binBoxes[b]);
+            rightCount += binCounts[b];
+            rightAreas[b] = AABB::area(right);
+            rightCounts[b] = rightCount;
+        }
+
+        auto left = emptyBox();
+        size_t leftCount = 0;
+        for (size_t b = 1; b < SAH_BIN_COUNT; ++b) {     // split between bin b - 1 and bin b
+            left = AABB::merge(left, binBoxes[b - 1]);
+            leftCount += binCounts[b - 1];
+            if (leftCount == 0 || rightCounts[b] == 0) continue;
+
+            auto cost = AABB::area(left) * float(leftCount) + rightAreas[b] * float(rightCounts[b]);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
         }
-        nodes.push_back(AABBNode::Node(node->box, bIds));
     }
-    return nodes.size() - 1;
+
+    if (bestAxis < 0) return begin;
+
+    auto scale = float(SAH_BIN_COUNT) / (cMax[bestAxis] - cMin[bestAxis]);
+    auto mid = std::partition(ids.begin() + begin, ids.begin() + end, [&](uint32_t id) {
+        return std::min(size_t((centroid(boxes[id])[bestAxis] - cMin[bestAxis]) * scale), SAH_BIN_COUNT - 1) < bestBin;
+    });
+
+    return size_t(mid - ids.begin());
 }
 
-////////////////////////////////////////////////////////////////////////////////
+void
+FlatBuilder::sah(FlatTree& tree, size_t slot, size_t begin, size_t end, size_t depth) {
+    auto box = bounds(begin, end);
 
-CollisionMesh::Ptr
-CollisionMesh::build(TriMesh::Ptr orig, size_t maxTriCountHint) {
+    if (end - begin <= ctx.maxTriCountHint || depth >= CollisionMesh::MAX_DEPTH) {
+        tree.leaf(slot, box, begin, end);
+        return;
+    }
+
+    struct Cluster {
+        size_t  begin;
+        size_t  end;
+        bool    splittable;
+    };
+
+    vector<Cluster> clusters = { { begin, end, true } };
+
+    while (clusters.size() < 8) {
+        // largest cluster that can still be split
+        int largest = -1;
+        for (size_t i = 0; i < clusters.size(); ++i) {
+            if (clusters[i].splittable && clusters[i].end - clusters[i].begin > 1 &&
+                (largest < 0 || clusters[i].end - clusters[i].begin > clusters[largest].end - clusters[largest].begin)) {
+                largest = int(i);
+            }
+        }
+        if (largest < 0) break;
+
+        auto c = clusters[largest];
+        auto mid = splitSAH(c.begin, c.end);
+        if (mid == c.begin || mid == c.end) {
+            clusters[largest].splittable = false;
+        } else {
+            clusters[largest] = { c.begin, mid, true };
+            clusters.push_back({ mid, c.end, true });
+        }
+    }
 
-    // build the bvh triangles
-    std::vector<BvhTri> bvhTris;
+    if (clusters.size() == 1) {     // SAH says keeping the triangles together is cheaper
+        tree.leaf(slot, box, begin, end);
+        return;
+    }
+
+    // keep the children in triangle order, it keeps neighbor leaves close in memory
+    std::sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.begin < b.begin; });
 
-    for (auto t : orig->tris()) {
-        bvhTris.push_back(BvhTri(t));
+    IdRange ranges[8];
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        ranges[i] = { uint32_t(clusters[i].begin), uint32_t(clusters[i].end) };
     }
 
-    // build the root node
-    auto root = BvhNode::subdivide(bvhTris, maxTriCountHint);
+    auto firstChild = tree.reserve(clusters.size());
+    buildChildren(&FlatBuilder::sah, tree, ranges, clusters.size(), depth, firstChild);
 
-    // collect the leaves
-    vector<AABBNode> nodes;
-    vector<TriMesh::Ptr> leaves;
-    size_t rootId = BvhNode::mapToAABBNodes(root, nodes, leaves);
- 
-    return Ptr(new CollisionMesh(rootId, nodes, leaves));
+    tree.node(slot, box, firstChild, clusters.size(), (1u << clusters.size()) - 1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-static glm::vec3
-closest(size_t node, const vector<AABBNode>& nodes, const vector<TriMesh::Ptr> meshes, const glm::vec3& pt, float radius, int& leaf) {
-    auto current = nodes[node];
+//
+// LBVH builder, linear in the triangle count:
+// - 63 bits Morton codes (21 bits per axis) of the triangle centroids in the mesh centroid bounds
+// - parallel LSD radix sort of the codes (stable, so the order doesn't depend on the thread count)
+// - the sorted codes are an octree already: every 3 bits digit splits a range in 8 contiguous sub ranges.
+//   The hierarchy is emitted straight into the flat node and leaf arrays, skipping the levels where
+//   all the triangles fall in the same octant
+//
+struct MortonTri {
+    uint64_t    code;
+    uint32_t    tri;
+};
 
-    int minLeaf = std::numeric_limits<int>::max();
-    float minDist = std::numeric_limits<float>::max();
-    vec3  minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+static const int MORTON_TOP_DIGIT = 60;    // low bit of the highest 3 bits digit
+
+static inline uint64_t
+expandBits21(uint64_t v) {     // abc -> 00a00b00c
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
 
-    if (AABB::intersectSphere(current.bbox(), pt, radius)) {
-        if (current.type() == AABBNode::Type::NODE) { // this is a node, loop through all children
-            auto node = static_cast<AABBNode::Node&>(current);
-            for (size_t i = 0; i < 8; ++i) {
-                int leaf;
-                auto clpt = closest(node[i], nodes, meshes, pt, radius, leaf);
-                auto dist = glm::length(clpt - pt);
-                if (dist < minDist && dist < radius) {
-                    minDist = dist;
-                    minPt = clpt;
-                    minLeaf = leaf;
-                }
+static inline uint64_t
+mortonCode(const vec3& p, const vec3& origin, const vec3& scale) {
+    auto q = glm::clamp((p - origin) * scale, vec3(0.0f), vec3(float(0x1fffff)));
+    return (expandBits21(uint64_t(q.x)) << 2) | (expandBits21(uint64_t(q.y)) << 1) | expandBits21(uint64_t(q.z));
+}
+
+static void
+radixSort(const BuildContext& ctx, vector<MortonTri>& keys) {
+    auto n = keys.size();
+    auto chunkCount = ctx.chunkCount(n);
+
+    vector<MortonTri> sorted(n);
+    vector<size_t> offsets(chunkCount * 256);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+
+        parallelFor(chunkCount, n, [&](size_t c, size_t begin, size_t end) {
+            auto histogram = &offsets[c * 256];
+            for (size_t i = begin; i < end; ++i) {
+                ++histogram[(keys[i].code >> shift) & 0xff];
+            }
+        });
+
+        // digit major, chunk minor: the chunks scatter to consecutive slots of each digit (stable)
+        size_t sum = 0;
+        bool singleDigit = false;
+        for (size_t d = 0; d < 256; ++d) {
+            size_t digitCount = 0;
+            for (size_t c = 0; c < chunkCount; ++c) {
+                auto count = offsets[c * 256 + d];
+                offsets[c * 256 + d] = sum;
+                sum += count;
+                digitCount += count;
             }
-            
-            leaf = minLeaf;
-            return minPt;
+            singleDigit = singleDigit || digitCount == n;
+        }
 
-        } else { // a leaf
-            auto lnode = static_cast<AABBNode::Leaf&>(current);
-            auto mesh = meshes[lnode.triMesh()];
-            auto clpt = TriMesh::closestOnMesh(mesh, pt);
-            auto dist = glm::length(clpt - pt);
-            if (dist < minDist && dist < radius) {
-                minDist = dist;
-                minPt = clpt;
-                minLeaf = node;
+        if (singleDigit) continue;  // nothing to sort on this digit
+
+        parallelFor(chunkCount, n, [&](size_t c, size_t begin, size_t end) {
+            auto offset = &offsets[c * 256];
+            for (size_t i = begin; i < end; ++i) {
+                sorted[offset[(keys[i].code >> shift) & 0xff]++] = keys[i];
             }
+        });
+
+        keys.swap(sorted);
+    }
+}
+
+static void
+emitLBVH(const BuildContext& ctx, const FlatBuilder& builder, const vector<uint64_t>& codes, size_t slot, size_t begin, size_t end, int digit, size_t depth, FlatTree& tree) {
+    // skip the digits shared by the whole range (the range is sorted: first and last are enough)
+    while (digit >= 0 && end - begin > ctx.maxTriCountHint && ((codes[begin] >> digit) & 7) == ((codes[end - 1] >> digit) & 7)) {
+        digit -= 3;
+    }
+
+    if (end - begin <= ctx.maxTriCountHint || digit < 0 || depth >= CollisionMesh::MAX_DEPTH) {
+        tree.leaf(slot, builder.bounds(begin, end), begin, end);
+        return;
+    }
 
-            leaf = minLeaf;
-            return minPt;
+    // the populated octants of the digit
+    IdRange children[8];
+    size_t childCount = 0;
+    uint32_t childMask = 0;
+
+    auto childBegin = begin;
+    for (uint64_t octant = 0; octant < 8; ++octant) {
+        auto childEnd = size_t(std::partition_point(codes.begin() + childBegin, codes.begin() + end, [&](uint64_t code) { return ((code >> digit) & 7) <= octant; }) - codes.begin());
+        if (childEnd > childBegin) {
+            children[childCount++] = { uint32_t(childBegin), uint32_t(childEnd) };
+            childMask |= 1u << octant;
         }
+        childBegin = childEnd;
+    }
 
-    } else {
-        leaf = minLeaf;
-        return minPt;
+    auto firstChild = tree.reserve(childCount);
+    auto box = emptyBox();
+    for (size_t i = 0; i < childCount; ++i) {
+        emitLBVH(ctx, builder, codes, firstChild + i, children[i].begin, children[i].end, digit - 3, depth + 1, tree);
+        box = AABB::merge(box, tree.nodes[firstChild + i].bbox());
     }
+
+    tree.node(slot, box, firstChild, childCount, childMask);
 }
 
-glm::vec3
-ProximityQuery::closestPointOnMesh(const glm::vec3& pt, float radius, int& leaf) const {
-    return closest(cm_->rootId(), cm_->nodes(), cm_->leaves(), pt, radius, leaf);
+static void
+buildLBVH(FlatBuilder& builder, FlatTree& tree, size_t depth = 0) {
+    const auto& ctx = builder.ctx;
+    const auto& boxes = builder.boxes;
+    auto chunkCount = ctx.chunkCount(boxes.size());
+
+    // centroid bounds
+    vector<AABB> chunkBoxes(chunkCount, emptyBox());
+    parallelFor(chunkCount, boxes.size(), [&](size_t c, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto center = centroid(boxes[i]);
+            chunkBoxes[c] = AABB::merge(chunkBoxes[c], AABB(center, center));
+        }
+    });
+
+    auto centroids = emptyBox();
+    for (const auto& b : chunkBoxes) {
+        centroids = AABB::merge(centroids, b);
+    }
+
+    // morton codes
+    auto extent = glm::max(centroids.max() - centroids.min(), vec3(std::numeric_limits<float>::min()));
+    auto scale = vec3(float(0x1fffff)) / extent;
+
+    vector<MortonTri> keys(boxes.size());
+    parallelFor(chunkCount, boxes.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            keys[i] = { mortonCode(centroid(boxes[i]), centroids.min(), scale), uint32_t(i) };
+        }
+    });
+
+    radixSort(ctx, keys);
+
+    vector<uint64_t> codes(keys.size());
+    parallelFor(chunkCount, keys.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            builder.ids[i] = keys[i].tri;
+            codes[i] = keys[i].code;
+        }
+    });
+    vector<MortonTri>().swap(keys);
+
+    emitLBVH(ctx, builder, codes, 0, 0, codes.size(), MORTON_TOP_DIGIT, depth, tree);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void
+setLane(WideNode& node, size_t lane, const AABB& box, uint32_t child) {
+    node.minX[lane] = box.min().x;
+    node.minY[lane] = box.min().y;
+    node.minZ[lane] = box.min().z;
+    node.maxX[lane] = box.max().x;
+    node.maxY[lane] = box.max().y;
+    node.maxZ[lane] = box.max().z;
+    node.child[lane] = child;
+}
+
+// the flat tree collapsed to wide nodes: every internal node becomes a wide node holding the bounds of its children,
+// the order is kept (root first, the sibling blocks in the same order)
+static void
+makeWideNodes(const FlatTree& tree, CollisionMesh::NodePool& nodes, vector<AABB>& leafBoxes) {
+    vector<uint32_t> wideIds(tree.nodes.size(), 0);
+    uint32_t wideCount = 0;
+    for (size_t i = 0; i < tree.nodes.size(); ++i) {
+        if (tree.nodes[i].type() == AABBNode::Type::NODE) wideIds[i] = wideCount++;
+    }
+
+    auto ref = [&](size_t i) -> uint32_t {
+        const auto& n = tree.nodes[i];
+        return n.type() == AABBNode::Type::LEAF ? WideNode::LEAF_BIT | static_cast<const AABBNode::Leaf&>(n).triMesh() : wideIds[i];
+    };
+
+    WideNode empty = WideNode();   // zeroed padding: the saved files are the same bytes build after build
+    for (size_t lane = 0; lane < WideNode::WIDTH; ++lane) {
+        setLane(empty, lane, emptyBox(), 0);
+    }
+    empty.childCount = 0;
+
+    leafBoxes.assign(tree.leaves.size(), emptyBox());
+    for (const auto& n : tree.nodes) {
+        if (n.type() == AABBNode::Type::LEAF) leafBoxes[static_cast<const AABBNode::Leaf&>(n).triMesh()] = n.bbox();
+    }
+
+    if (tree.nodes[0].type() == AABBNode::Type::LEAF) {     // the root is a leaf: a single lane root node
+        nodes.assign(1, empty);
+        setLane(nodes[0], 0, tree.nodes[0].bbox(), ref(0));
+        nodes[0].childCount = 1;
+        return;
+    }
+
+    nodes.assign(wideCount, empty);
+    for (size_t i = 0; i < tree.nodes.size(); ++i) {
+        if (tree.nodes[i].type() != AABBNode::Type::NODE) continue;
+
+        const auto& n = static_cast<const AABBNode::Node&>(tree.nodes[i]);
+        auto& w = nodes[wideIds[i]];
+        for (size_t c = 0; c < n.childCount(); ++c) {
+            setLane(w, c, tree.nodes[n.firstChild() + c].bbox(), ref(n.firstChild() + c));
+        }
+        w.childCount = n.childCount();
+    }
+}
+
+// the triangle records of a leaf, its last block is padded by repeating its last triangle
+static void
+packLeafRecords(const TriPositions& tris, const vector<uint32_t>& ids, const CollisionMesh::LeafRange& leaf, float* block) {
+    size_t triCount = leaf.triCount;
+
+    for (size_t t = 0; t < (triCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH; ++t) {
+        auto tri = ids[leaf.firstTri + std::min(t, triCount - 1)];
+        auto r = makeRecord(tris(tri, 0), tris(tri, 1), tris(tri, 2));
+
+        auto stream = reinterpret_cast<const float*>(&r);
+        auto lane = block + (t / SIMD_WIDTH) * CollisionMesh::BLOCK_FLOATS + t % SIMD_WIDTH;
+        for (size_t i = 0; i < CollisionMesh::BLOCK_STREAMS; ++i) {
+            lane[i * SIMD_WIDTH] = stream[i];
+        }
+    }
+}
+
+// pack the leaf triangle records into SIMD_WIDTH wide blocks, the leaves are independent once their offsets are known
+static void
+packLeafBlocks(const BuildContext& ctx, const TriPositions& tris, const vector<uint32_t>& ids, const vector<IdRange>& ranges, vector<CollisionMesh::LeafRange>& leaves, CollisionMesh::BlockPool& blocks) {
+    uint32_t blockCount = 0;
+    for (const auto& r : ranges) {
+        leaves.push_back({ blockCount, r.begin, r.end - r.begin });
+        blockCount += uint32_t((r.end - r.begin + SIMD_WIDTH - 1) / SIMD_WIDTH);
+    }
+
+    blocks.resize(size_t(blockCount) * CollisionMesh::BLOCK_FLOATS);
+
+    parallelFor(ctx.chunkCount(size_t(blockCount) * SIMD_WIDTH), leaves.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t l = begin; l < end; ++l) {
+            packLeafRecords(tris, ids, leaves[l], blocks.data() + size_t(leaves[l].firstBlock) * CollisionMesh::BLOCK_FLOATS);
+        }
+    });
+}
+
+CollisionMesh::Ptr
+CollisionMesh::build(TriMesh::Ptr orig, size_t maxTriCountHint, BuildMethod method, size_t threadCount) {
+    auto cm = build(TriPositions::of(*orig), maxTriCountHint, method, threadCount);
+    cm->mesh_ = orig;
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::build(IndexedTriMesh::Ptr orig, size_t maxTriCountHint, BuildMethod method, size_t threadCount) {
+    auto cm = build(TriPositions::of(*orig), maxTriCountHint, method, threadCount);
+    cm->indexedMesh_ = orig;
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::build(const TriPositions& tris, size_t maxTriCountHint, BuildMethod method, size_t threadCount) {
+    if (tris.triCount > 0 && (tris.positions == nullptr || tris.stride < sizeof(glm::vec3))) {
+        cerr << "Error: invalid triangle positions" << endl;
+        return nullptr;
+    }
+
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    BuildContext ctx(maxTriCountHint, threadCount);
+
+    auto chunkCount = ctx.chunkCount(tris.triCount);
+
+    // the triangle boxes and the id array partitioned by the builders
+    vector<AABB> boxes(tris.triCount, emptyBox());
+    vector<uint32_t> ids(tris.triCount);
+    vector<uint32_t> scratch(method == BuildMethod::OCTREE ? tris.triCount : 0);
+
+    parallelFor(chunkCount, tris.triCount, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto v0 = tris(i, 0);
+            auto v1 = tris(i, 1);
+            auto v2 = tris(i, 2);
+            boxes[i] = AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+            ids[i] = uint32_t(i);
+        }
+    });
+
+    FlatBuilder builder(ctx, boxes, ids, scratch);
+    FlatTree tree;
+    size_t rootId = tree.reserve(1);
+
+    switch (method) {
+    case BuildMethod::SAH:  builder.sah(tree, rootId, 0, ids.size(), 0); break;
+    case BuildMethod::LBVH: buildLBVH(builder, tree); break;
+    default:                builder.octree(tree, rootId, 0, ids.size(), 0); break;
+    }
+
+    // the boxes and the scratch are not needed anymore, keep the peak memory down
+    vector<AABB>().swap(boxes);
+    vector<uint32_t>().swap(scratch);
+
+    NodePool nodes;
+    vector<AABB> leafBoxes;
+    makeWideNodes(tree, nodes, leafBoxes);
+
+    // the leaves are id ranges already ordered by leaf: ids is the attribute stream as is
+    vector<LeafRange> leaves;
+    BlockPool blocks;
+    packLeafBlocks(ctx, tris, ids, tree.leaves, leaves, blocks);
+
+    auto cm = Ptr(new CollisionMesh(rootId, std::move(nodes), std::move(leaves), std::move(leafBoxes), std::move(blocks), std::move(ids), tris));
+    cm->maxTriCountHint_ = maxTriCountHint;
+    cm->buildMethod_ = method;
+    cm->builtSahCost_ = cm->sahCost();
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::collapse(size_t maxTriCountHint, size_t threadCount) const {
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    BuildContext ctx(maxTriCountHint, threadCount);
+    auto expanded = nodeFormat() == NodeFormat::COMPRESSED ? expandedNodes() : NodePool();
+    auto oldNodes = expanded.empty() ? nodes() : ArrayView<WideNode>(expanded);
+    auto oldLeaves = leaves();
+    auto oldTriIds = triIds();
+
+    // the triangle count of every subtree: the nodes in depth first order, then summed up in reverse
+    vector<uint32_t> order = { uint32_t(rootId_) };
+    for (size_t i = 0; i < order.size(); ++i) {
+        const auto& n = oldNodes[order[i]];
+        for (size_t c = 0; c < n.childCount; ++c) {
+            if (!WideNode::isLeaf(n.child[c])) order.push_back(n.child[c]);
+        }
+    }
+
+    vector<uint32_t> counts(oldNodes.size(), 0);
+    for (size_t i = order.size(); i-- > 0; ) {
+        const auto& n = oldNodes[order[i]];
+        for (size_t c = 0; c < n.childCount; ++c) {
+            auto child = WideNode::index(n.child[c]);
+            counts[order[i]] += WideNode::isLeaf(n.child[c]) ? oldLeaves[child].triCount : counts[child];
+        }
+    }
+
+    vector<uint32_t> ids;
+    vector<IdRange> ranges;
+    vector<AABB> leafBoxes;
+    ids.reserve(triCount_);
+
+    // the triangles of a subtree appended as one leaf
+    vector<uint32_t> subtree;
+    auto appendLeaf = [&](uint32_t child, const AABB& box) {
+        auto begin = uint32_t(ids.size());
+        subtree.assign(1, child);
+        while (!subtree.empty()) {
+            auto c = subtree.back();
+            subtree.pop_back();
+
+            if (WideNode::isLeaf(c)) {
+                const auto& lr = oldLeaves[WideNode::index(c)];
+                ids.insert(ids.end(), oldTriIds.begin() + lr.firstTri, oldTriIds.begin() + lr.firstTri + lr.triCount);
+                continue;
+            }
+
+            const auto& n = oldNodes[c];
+            subtree.insert(subtree.end(), std::reverse_iterator<const uint32_t*>(n.child + n.childCount), std::reverse_iterator<const uint32_t*>(n.child));
+        }
+        ranges.push_back({ begin, uint32_t(ids.size()) });
+        leafBoxes.push_back(box);
+        return WideNode::LEAF_BIT | uint32_t(ranges.size() - 1);
+    };
+
+    WideNode empty = WideNode();
+    for (size_t lane = 0; lane < WideNode::WIDTH; ++lane) {
+        setLane(empty, lane, emptyBox(), 0);
+    }
+    empty.childCount = 0;
+
+    NodePool nodes(1, empty);
+    const auto& root = oldNodes[rootId_];
+    if (counts[rootId_] <= maxTriCountHint) {   // the root is a leaf: a single lane root node
+        auto box = emptyBox();
+        for (size_t c = 0; c < root.childCount; ++c) {
+            box = AABB::merge(box, root.childBox(c));
+        }
+        setLane(nodes[0], 0, box, appendLeaf(uint32_t(rootId_), box));
+        nodes[0].childCount = 1;
+    }
+
+    struct Pending {
+        uint32_t    old;        // in oldNodes
+        uint32_t    slot;       // in nodes
+    };
+
+    // depth first from the root, the node children of a node get a contiguous block when the node is visited
+    vector<Pending> pending;
+    if (nodes[0].childCount == 0) pending.push_back({ uint32_t(rootId_), 0 });
+    while (!pending.empty()) {
+        auto p = pending.back();
+        pending.pop_back();
+
+        const auto& n = oldNodes[p.old];
+        auto w = empty;
+
+        auto firstPending = pending.size();
+        for (size_t c = 0; c < n.childCount; ++c) {
+            auto child = n.child[c];
+            auto box = n.childBox(c);
+
+            if (WideNode::isLeaf(child)) {
+                if (oldLeaves[WideNode::index(child)].triCount > 0) setLane(w, w.childCount++, box, appendLeaf(child, box));
+            } else if (counts[child] == 0) {
+                continue;
+            } else if (counts[child] <= maxTriCountHint) {
+                setLane(w, w.childCount++, box, appendLeaf(child, box));
+            } else {
+                pending.push_back({ child, uint32_t(nodes.size()) });
+                setLane(w, w.childCount++, box, uint32_t(nodes.size()));
+                nodes.push_back(empty);
+            }
+        }
+
+        std::reverse(pending.begin() + firstPending, pending.end());   // first child on top
+        nodes[p.slot] = w;
+    }
+
+    vector<LeafRange> leaves;
+    BlockPool blocks;
+    packLeafBlocks(ctx, source_, ids, ranges, leaves, blocks);
+
+    auto cm = Ptr(new CollisionMesh(0, std::move(nodes), std::move(leaves), std::move(leafBoxes), std::move(blocks), std::move(ids), source_));
+    cm->mesh_ = mesh_;
+    cm->indexedMesh_ = indexedMesh_;
+    cm->file_ = file_;
+    cm->triCount_ = cm->triIds_.size();
+    cm->maxTriCountHint_ = maxTriCountHint;
+    cm->buildMethod_ = buildMethod_;
+    cm->builtSahCost_ = cm->sahCost();
+    return cm;
+}
+
+TriMesh::Tri
+CollisionMesh::sourceTri(size_t tri) const {
+    if (mesh_) return mesh_->tris()[tri];
+    if (indexedMesh_) return indexedMesh_->tri(tri);
+
+    TriMesh::Tri t;
+    for (size_t c = 0; c < 3; ++c) {
+        t.v[c].position = source_(tri, c);
+        t.v[c].color = vec4(0.0f);
+    }
+
+    auto n = glm::cross(t.v[1].position - t.v[0].position, t.v[2].position - t.v[0].position);
+    auto len = glm::length(n);
+    t.v[0].normal = t.v[1].normal = t.v[2].normal = len > 0.0f ? n / len : vec3(0.0f);
+    return t;
+}
+
+static inline TriRecordL<SimdFloat>
+loadBlockRecord(const float* block) {
+    TriRecordL<SimdFloat> r;
+    auto stream = reinterpret_cast<SimdFloat*>(&r);    // the record is CollisionMesh::BLOCK_STREAMS floats
+    for (size_t i = 0; i < CollisionMesh::BLOCK_STREAMS; ++i) {
+        stream[i] = simdLoad(block + i * SIMD_WIDTH);
+    }
+    return r;
+}
+
+static inline TriRecordL<float>
+laneRecord(const float* block, size_t lane) {
+    TriRecordL<float> r;
+    auto stream = reinterpret_cast<float*>(&r);
+    for (size_t i = 0; i < CollisionMesh::BLOCK_STREAMS; ++i) {
+        stream[i] = block[i * SIMD_WIDTH + lane];
+    }
+    return r;
+}
+
+// exact closest point on the triangle in the block lane
+static inline vec3
+closestOnLane(const float* block, size_t lane, const vec3& pt) {
+    auto r = laneRecord(block, lane);
+
+    float s, t;
+    sqDistToTri(r, { pt.x, pt.y, pt.z }, s, t);
+    return pointOnRecord(r, s, t);
+}
+
+// SIMD_WIDTH triangles per step, the lanes keep their own minimum and are reduced once at the end of the leaf.
+// minTri is the index of the closest triangle in the triIds() attribute stream
+static bool
+closestOnRecordLeaf(const CollisionMesh& cm, size_t leaf, const vec3& pt, float& minSqDist, vec3& minPt, size_t& minTri) {
+    const auto& lr = cm.leaves()[leaf];
+    if (lr.triCount == 0) return false;
+
+    auto blockCount = (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+    auto blocks = cm.blocks().data() + size_t(lr.firstBlock) * CollisionMesh::BLOCK_FLOATS;
+
+    Vec3L<SimdFloat> p = { simdSet(pt.x), simdSet(pt.y), simdSet(pt.z) };
+    auto laneMin = simdSet(std::numeric_limits<float>::infinity());
+    auto laneBlock = simdSet(0.0f);
+
+    for (size_t b = 0; b < blockCount; ++b) {
+        auto block = blocks + b * CollisionMesh::BLOCK_FLOATS;
+
+        SimdFloat s, t;
+        auto sqDist = sqDistToTri(loadBlockRecord(block), p, s, t);
+
+        auto closer = sqDist < laneMin;
+        laneMin = simdSelect(closer, sqDist, laneMin);
+        laneBlock = simdSelect(closer, simdSet(float(b)), laneBlock);
+    }
+
+    auto leafMin = simdHMin(laneMin);
+    if (!(leafMin < minSqDist)) return false;
+
+    // find the winner lane and compute its point
+    float mins[SIMD_WIDTH], blockIds[SIMD_WIDTH];
+    simdStore(mins, laneMin);
+    simdStore(blockIds, laneBlock);
+
+    size_t lane = 0;
+    while (mins[lane] != leafMin) ++lane;
+
+    minSqDist = leafMin;
+    minPt = closestOnLane(blocks + size_t(blockIds[lane]) * CollisionMesh::BLOCK_FLOATS, lane, pt);
+    minTri = lr.firstTri + std::min(size_t(blockIds[lane]) * SIMD_WIDTH + lane, size_t(lr.triCount) - 1);   // the padding repeats the last triangle
+    return true;
+}
+
+// positions of the QUANTIZED block lanes dequantized and turned into query records
+static inline TriRecordL<SimdFloat>
+loadQuantizedRecord(const uint16_t* block, const Vec3L<SimdFloat>& origin, const Vec3L<SimdFloat>& scale) {
+    Vec3L<SimdFloat> v[3];
+    for (size_t i = 0; i < 3; ++i) {
+        auto stream = block + i * 3 * SIMD_WIDTH;
+        v[i] = { origin.x + simdLoadU16(stream) * scale.x
+               , origin.y + simdLoadU16(stream + SIMD_WIDTH) * scale.y
+               , origin.z + simdLoadU16(stream + 2 * SIMD_WIDTH) * scale.z };
+    }
+    return makeRecordL(v[0], v[1], v[2]);
+}
+
+// a quantized squared distance below this bound might belong to a triangle closer than minSqDist
+static inline float
+candidateSqBound(float minSqDist, float error) {
+    auto d = std::sqrt(minSqDist) + error;
+    return d * d;
+}
+
+// full precision distance to the leaf triangle id (in triIds()), keeps it if it beats minSqDist
+static inline bool
+refineOnSource(const CollisionMesh& cm, size_t id, const vec3& pt, float& minSqDist, vec3& minPt, size_t& minTri) {
+    const auto& tris = cm.source();
+    auto tri = cm.triIds()[id];
+    auto r = makeRecord(tris(tri, 0), tris(tri, 1), tris(tri, 2));
+
+    float s, t;
+    auto sqDist = sqDistToTri(r, { pt.x, pt.y, pt.z }, s, t);
+    if (!(sqDist < minSqDist)) return false;
+
+    minSqDist = sqDist;
+    minPt = pointOnRecord(r, s, t);
+    minTri = id;
+    return true;
+}
+
+//
+// QUANTIZED leaves, the quantized distances only select the candidates (distance - error < best distance):
+// - the nearest quantized triangle is refined first with its full precision source triangle
+// - the leaf is scanned again only if another quantized distance (the lanes keep their 2 smallest) is still
+//   under the refined bound, the error is small and this is rare
+//
+static bool
+closestOnQuantizedLeaf(const CollisionMesh& cm, size_t leaf, const vec3& pt, float& minSqDist, vec3& minPt, size_t& minTri) {
+    const auto& lr = cm.leaves()[leaf];
+    if (lr.triCount == 0) return false;
+
+    const auto& lq = cm.quantization()[leaf];
+    auto blockCount = (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+    auto blocks = cm.quantizedBlocks().data() + size_t(lr.firstBlock) * CollisionMesh::QBLOCK_VALUES;
+
+    Vec3L<SimdFloat> p = { simdSet(pt.x), simdSet(pt.y), simdSet(pt.z) };
+    Vec3L<SimdFloat> origin = { simdSet(lq.origin.x), simdSet(lq.origin.y), simdSet(lq.origin.z) };
+    Vec3L<SimdFloat> scale = { simdSet(lq.scale.x), simdSet(lq.scale.y), simdSet(lq.scale.z) };
+    auto laneMin = simdSet(std::numeric_limits<float>::infinity());
+    auto laneSecond = laneMin;
+    auto laneBlock = simdSet(0.0f);
+
+    for (size_t b = 0; b < blockCount; ++b) {
+        SimdFloat s, t;
+        auto sqDist = sqDistToTri(loadQuantizedRecord(blocks + b * CollisionMesh::QBLOCK_VALUES, origin, scale), p, s, t);
+
+        auto closer = sqDist < laneMin;
+        laneSecond = simdMin(laneSecond, simdSelect(closer, laneMin, sqDist));
+        laneMin = simdSelect(closer, sqDist, laneMin);
+        laneBlock = simdSelect(closer, simdSet(float(b)), laneBlock);
+    }
+
+    auto leafMin = simdHMin(laneMin);
+    if (!(leafMin < candidateSqBound(minSqDist, lq.error))) return false;
+
+    float mins[SIMD_WIDTH], seconds[SIMD_WIDTH], blockIds[SIMD_WIDTH];
+    simdStore(mins, laneMin);
+    simdStore(seconds, laneSecond);
+    simdStore(blockIds, laneBlock);
+
+    size_t lane = 0;
+    while (mins[lane] != leafMin) ++lane;
+
+    auto winner = std::min(size_t(blockIds[lane]) * SIMD_WIDTH + lane, size_t(lr.triCount) - 1);   // the padding repeats the last triangle
+    auto found = refineOnSource(cm, lr.firstTri + winner, pt, minSqDist, minPt, minTri);
+
+    auto bound = candidateSqBound(minSqDist, lq.error);
+    mins[lane] = seconds[lane];
+
+    bool others = false;
+    for (size_t i = 0; i < SIMD_WIDTH; ++i) {
+        others = others || mins[i] < bound;
+    }
+    if (!others) return found;
+
+    for (size_t b = 0; b < blockCount; ++b) {
+        SimdFloat s, t;
+        float sqDists[SIMD_WIDTH];
+        simdStore(sqDists, sqDistToTri(loadQuantizedRecord(blocks + b * CollisionMesh::QBLOCK_VALUES, origin, scale), p, s, t));
+
+        for (size_t i = 0; i < SIMD_WIDTH && b * SIMD_WIDTH + i < lr.triCount; ++i) {
+            if (sqDists[i] < bound && b * SIMD_WIDTH + i != winner && refineOnSource(cm, lr.firstTri + b * SIMD_WIDTH + i, pt, minSqDist, minPt, minTri)) {
+                bound = candidateSqBound(minSqDist, lq.error);
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+// MESHLETS leaves: SIMD_WIDTH triangles per step, their corners are gathered from the meshlet vertices.
+// The positions are exact: the winner point is computed on its source triangle
+static bool
+closestOnMeshletLeaf(const CollisionMesh& cm, size_t leaf, const vec3& pt, float& minSqDist, vec3& minPt, size_t& minTri) {
+    static const float LANE_IDS[] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f };
+    static_assert(sizeof(LANE_IDS) / sizeof(float) >= SIMD_WIDTH, "a lane id per SIMD lane");
+
+    const auto& lr = cm.leaves()[leaf];
+    if (lr.triCount == 0) return false;
+
+    const auto& corners = cm.meshletCorners();
+    Vec3L<SimdFloat> p = { simdSet(pt.x), simdSet(pt.y), simdSet(pt.z) };
+    auto laneMin = simdSet(std::numeric_limits<float>::infinity());
+    auto laneTri = simdSet(0.0f);
+    auto laneIds = simdLoad(LANE_IDS);
+
+    auto m = cm.meshlets().data() + cm.leafMeshlets()[leaf];
+    for (size_t done = 0; done < lr.triCount; done += m->triCount, ++m) {
+        auto vertices = cm.meshletVertices().data() + size_t(m->firstVertex) * 3;
+        auto leafTri = float(m->firstTri - lr.firstTri);    // the lanes keep the index of their closest triangle in the leaf
+
+        for (size_t t = 0; t < m->triCount; t += SIMD_WIDTH) {
+            int32_t offsets[3][SIMD_WIDTH];
+            for (size_t lane = 0; lane < SIMD_WIDTH; ++lane) {
+                auto corner = corners.data() + (m->firstTri + std::min(t + lane, size_t(m->triCount) - 1)) * 3;  // pad with the last triangle
+                for (size_t c = 0; c < 3; ++c) {
+                    offsets[c][lane] = int32_t(corner[c]) * 3;
+                }
+            }
+
+            Vec3L<SimdFloat> v[3];
+            for (size_t c = 0; c < 3; ++c) {
+                v[c] = { simdGather(vertices, offsets[c]), simdGather(vertices + 1, offsets[c]), simdGather(vertices + 2, offsets[c]) };
+            }
+
+            SimdFloat s, u;
+            auto sqDist = sqDistToTri(makeRecordL(v[0], v[1], v[2]), p, s, u);
+
+            auto closer = sqDist < laneMin;
+            laneMin = simdSelect(closer, sqDist, laneMin);
+            laneTri = simdSelect(closer, simdMin(simdSet(leafTri + float(t)) + laneIds, simdSet(leafTri + float(m->triCount - 1))), laneTri);
+        }
+    }
+
+    auto leafMin = simdHMin(laneMin);
+    if (!(leafMin < minSqDist)) return false;
+
+    float mins[SIMD_WIDTH], tris[SIMD_WIDTH];
+    simdStore(mins, laneMin);
+    simdStore(tris, laneTri);
+
+    size_t lane = 0;
+    while (mins[lane] != leafMin) ++lane;
+
+    return refineOnSource(cm, lr.firstTri + size_t(tris[lane]), pt, minSqDist, minPt, minTri);
+}
+
+static inline bool
+closestOnLeaf(const CollisionMesh& cm, size_t leaf, const vec3& pt, float& minSqDist, vec3& minPt, size_t& minTri) {
+    switch (cm.leafFormat()) {
+    case CollisionMesh::LeafFormat::QUANTIZED:  return closestOnQuantizedLeaf(cm, leaf, pt, minSqDist, minPt, minTri);
+    case CollisionMesh::LeafFormat::MESHLETS:   return closestOnMeshletLeaf(cm, leaf, pt, minSqDist, minPt, minTri);
+    default:                                    return closestOnRecordLeaf(cm, leaf, pt, minSqDist, minPt, minTri);
+    }
+}
+
+// the quantized positions of a leaf, in its own blocks
+static CollisionMesh::LeafQuantization
+quantizeLeaf(const TriPositions& tris, const vector<uint32_t>& ids, const CollisionMesh::LeafRange& leaf, uint16_t* block) {
+    size_t triCount = leaf.triCount;
+    if (triCount == 0) return { vec3(0.0f), vec3(0.0f), 0.0f };
+
+    // the leaf vertices bounds: the leaf box can be looser
+    auto mn = vec3(std::numeric_limits<float>::max());
+    auto mx = vec3(-std::numeric_limits<float>::max());
+    for (size_t t = 0; t < triCount; ++t) {
+        for (size_t v = 0; v < 3; ++v) {
+            auto position = tris(ids[leaf.firstTri + t], v);
+            mn = glm::min(mn, position);
+            mx = glm::max(mx, position);
+        }
+    }
+
+    auto scale = (mx - mn) / 65535.0f;
+    float error = 0.0f;
+
+    for (size_t t = 0; t < (triCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH; ++t) {
+        auto tri = ids[leaf.firstTri + std::min(t, triCount - 1)];
+        auto lane = block + (t / SIMD_WIDTH) * CollisionMesh::QBLOCK_VALUES + t % SIMD_WIDTH;
+
+        for (size_t v = 0; v < 3; ++v) {
+            auto source = tris(tri, v);
+            vec3 position;
+            for (glm::length_t c = 0; c < 3; ++c) {
+                auto q = scale[c] > 0.0f ? std::min(std::max(std::round((source[c] - mn[c]) / scale[c]), 0.0f), 65535.0f) : 0.0f;
+                lane[(v * 3 + c) * SIMD_WIDTH] = uint16_t(q);
+                position[c] = mn[c] + q * scale[c];
+            }
+            error = std::max(error, glm::length(position - source));
+        }
+    }
+
+    // plus some slack for the float rounding of the dequantization and of the distances
+    auto magnitude = std::max(glm::length(mn), glm::length(mx));
+    return { mn, scale, error + 8.0f * std::numeric_limits<float>::epsilon() * magnitude };
+}
+
+void
+CollisionMesh::quantizeLeaves() {
+    if (leafFormat_ != LeafFormat::RECORDS) return;
+    ownPools();
+
+    QuantizedPool blocks(blocks_.size() / BLOCK_FLOATS * QBLOCK_VALUES);
+    vector<LeafQuantization> quantization(leaves_.size());
+
+    for (size_t l = 0; l < leaves_.size(); ++l) {
+        quantization[l] = quantizeLeaf(source_, triIds_, leaves_[l], blocks.data() + size_t(leaves_[l].firstBlock) * QBLOCK_VALUES);
+    }
+
+    BlockPool().swap(blocks_);
+    quantizedBlocks_.swap(blocks);
+    quantization_.swap(quantization);
+    leafFormat_ = LeafFormat::QUANTIZED;
+}
+
+//
+// the vertices of the meshlet being built: open addressing on the exact position bits, the table is
+// twice the meshlet vertex count so the probes stay short
+//
+struct MeshletVertices {
+    static const size_t     SLOTS = 2 * CollisionMesh::MESHLET_VERTICES;
+
+    vector<float>&  vertices;           // the pool, the meshlet vertices are at its end
+    size_t          firstVertex;
+    uint16_t        slots[SLOTS];       // local index + 1, 0 for an empty slot
+
+    MeshletVertices(vector<float>& v) : vertices(v) { reset(); }
+
+    size_t  count() const { return vertices.size() / 3 - firstVertex; }
+
+    void
+    reset() {
+        firstVertex = vertices.size() / 3;
+        std::fill(slots, slots + SLOTS, uint16_t(0));
+    }
+
+    static size_t
+    hash(const vec3& v) {
+        uint32_t bits[3];
+        std::memcpy(bits, &v[0], sizeof(bits));
+        return (bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u) & (SLOTS - 1);
+    }
+
+    // the slot holding v, or the empty slot where it goes
+    size_t
+    slot(const vec3& v) const {
+        auto i = hash(v);
+        while (slots[i] != 0) {
+            auto local = (firstVertex + slots[i] - 1) * 3;
+            if (vertices[local] == v.x && vertices[local + 1] == v.y && vertices[local + 2] == v.z) break;
+            i = (i + 1) & (SLOTS - 1);
+        }
+        return i;
+    }
+
+    uint8_t
+    insert(const vec3& v) {
+        auto i = slot(v);
+        if (slots[i] == 0) {
+            vertices.insert(vertices.end(), { v.x, v.y, v.z });
+            slots[i] = uint16_t(count());
+        }
+        return uint8_t(slots[i] - 1);
+    }
+};
+
+// the meshlets of a leaf, appended to the pools (the corners are in leaf order, they already have their place)
+static void
+appendLeafMeshlets(const TriPositions& tris, const vector<uint32_t>& ids, const CollisionMesh::LeafRange& leaf, MeshletVertices& local, vector<CollisionMesh::Meshlet>& meshlets, uint8_t* corners) {
+    for (size_t t = leaf.firstTri; t < size_t(leaf.firstTri) + leaf.triCount; ++t) {
+        vec3 tri[3] = { tris(ids[t], 0), tris(ids[t], 1), tris(ids[t], 2) };
+
+        // the distinct corners missing from the meshlet, a full meshlet is closed
+        size_t missing = 0;
+        for (size_t c = 0; c < 3; ++c) {
+            bool repeated = (c > 0 && tri[c] == tri[0]) || (c > 1 && tri[c] == tri[1]);
+            if (!repeated && local.slots[local.slot(tri[c])] == 0) ++missing;
+        }
+
+        if (t == leaf.firstTri || local.count() + missing > CollisionMesh::MESHLET_VERTICES) {
+            local.reset();
+            meshlets.push_back({ uint32_t(local.firstVertex), uint32_t(t), 0 });
+        }
+
+        for (size_t c = 0; c < 3; ++c) {
+            corners[t * 3 + c] = local.insert(tri[c]);
+        }
+        ++meshlets.back().triCount;
+    }
+}
+
+void
+CollisionMesh::makeMeshlets() {
+    if (leafFormat_ != LeafFormat::RECORDS) return;
+    ownPools();
+
+    vector<Meshlet> meshlets;
+    vector<uint32_t> leafMeshlets(leaves_.size());
+    vector<float> vertices;
+    vector<uint8_t> corners(triIds_.size() * 3);
+    MeshletVertices local(vertices);
+
+    for (size_t l = 0; l < leaves_.size(); ++l) {
+        leafMeshlets[l] = uint32_t(meshlets.size());
+        appendLeafMeshlets(source_, triIds_, leaves_[l], local, meshlets, corners.data());
+    }
+
+    BlockPool().swap(blocks_);
+    meshlets_.swap(meshlets);
+    leafMeshlets_.swap(leafMeshlets);
+    meshletVertices_.swap(vertices);
+    meshletCorners_.swap(corners);
+    leafFormat_ = LeafFormat::MESHLETS;
+}
+
+void
+CollisionMesh::reorderNodes(size_t treeletBytes) {
+    if (nodeFormat() == NodeFormat::COMPRESSED) return;    // compressNodes lays the nodes out depth first
+    ownPools();
+
+    auto treeletSize = std::max<size_t>(1, treeletBytes / sizeof(WideNode));
+
+    vector<uint32_t> order;             // new position -> old index
+    vector<uint32_t> treeletRoots = { uint32_t(rootId_) };
+    vector<uint32_t> below;
+    order.reserve(nodes_.size());
+
+    while (!treeletRoots.empty()) {
+        auto root = treeletRoots.back();
+        treeletRoots.pop_back();
+
+        // breadth first from the treelet root until the treelet is full, the rest roots the next treelets.
+        // The children of a node join the treelet together or not at all: siblings stay contiguous
+        auto first = order.size();
+        order.push_back(root);
+        for (size_t i = first; i < order.size(); ++i) {
+            const auto& n = nodes_[order[i]];
+
+            size_t nodeChildren = 0;
+            for (size_t c = 0; c < n.childCount; ++c) {
+                if (!WideNode::isLeaf(n.child[c])) ++nodeChildren;
+            }
+
+            auto& dst = order.size() - first + nodeChildren <= treeletSize ? order : below;
+            for (size_t c = 0; c < n.childCount; ++c) {
+                if (!WideNode::isLeaf(n.child[c])) dst.push_back(n.child[c]);
+            }
+        }
+
+        treeletRoots.insert(treeletRoots.end(), below.rbegin(), below.rend());  // first child subtree on top
+        below.clear();
+    }
+
+    vector<uint32_t> newIds(nodes_.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        newIds[order[i]] = uint32_t(i);
+    }
+
+    NodePool nodes(order.size());     // the nodes replaced by the edits are not reached
+    for (size_t i = 0; i < order.size(); ++i) {
+        nodes[i] = nodes_[order[i]];
+        for (size_t c = 0; c < nodes[i].childCount; ++c) {
+            if (!WideNode::isLeaf(nodes[i].child[c])) nodes[i].child[c] = newIds[nodes[i].child[c]];
+        }
+    }
+
+    nodes_.swap(nodes);
+    rootId_ = 0;
+    refitMap_.reset();
+}
+
+// the box the lanes of a COMPRESSED node are decoded in, 255 steps reach a bit past the box max (see CompressedNode)
+struct NodeFrame {
+    vec3    origin;
+    vec3    step;
+};
+
+static inline NodeFrame
+makeFrame(const vec3& mn, const vec3& mx) {
+    return { mn, (mx - mn) * (1.0f / 254.0f) };
+}
+
+// conservative 8 bits lane bounds: the decoded [qMin, qMax] contains [mn, mx]
+static inline void
+quantizeBounds(float mn, float mx, float origin, float step, uint8_t& qMin, uint8_t& qMax) {
+    if (!(mn <= mx)) {          // empty box, decodes inverted
+        qMin = 255;
+        qMax = 0;
+        return;
+    }
+
+    if (!(step > 0.0f)) {       // flat frame, everything is at the origin
+        qMin = 0;
+        qMax = 0;
+        return;
+    }
+
+    auto lo = int(std::min(std::max(std::floor((mn - origin) / step), 0.0f), 255.0f));
+    auto hi = int(std::min(std::max(std::ceil((mx - origin) / step), 0.0f), 255.0f));
+
+    // the division rounds, the decoding is what the queries see
+    while (lo > 0 && origin + float(lo) * step > mn) --lo;
+    while (hi < 255 && origin + float(hi) * step < mx) ++hi;
+
+    qMin = uint8_t(lo);
+    qMax = uint8_t(hi);
+}
+
+// the wide node lanes in the COMPRESSED order: the node children first, then the leaf children. Returns the node count
+static inline size_t
+compressedLanes(const WideNode& n, size_t* lanes) {
+    size_t laneCount = 0;
+    for (size_t c = 0; c < n.childCount; ++c) {
+        if (!WideNode::isLeaf(n.child[c])) lanes[laneCount++] = c;
+    }
+    size_t nodeCount = laneCount;
+    for (size_t c = 0; c < n.childCount; ++c) {
+        if (WideNode::isLeaf(n.child[c])) lanes[laneCount++] = c;
+    }
+    return nodeCount;
+}
+
+static inline void
+quantizeLane(const AABB& box, const NodeFrame& f, CompressedNode& cn, size_t l) {
+    quantizeBounds(box.min().x, box.max().x, f.origin.x, f.step.x, cn.qMinX[l], cn.qMaxX[l]);
+    quantizeBounds(box.min().y, box.max().y, f.origin.y, f.step.y, cn.qMinY[l], cn.qMaxY[l]);
+    quantizeBounds(box.min().z, box.max().z, f.origin.z, f.step.z, cn.qMinZ[l], cn.qMaxZ[l]);
+}
+
+// the lane l of cn holds the wide lane c of n, l >= childCount is an unused (empty) lane
+static inline void
+quantizeLane(const WideNode& n, size_t c, const NodeFrame& f, CompressedNode& cn, size_t l) {
+    if (l >= cn.childCount) {
+        cn.qMinX[l] = cn.qMinY[l] = cn.qMinZ[l] = 255;
+        cn.qMaxX[l] = cn.qMaxY[l] = cn.qMaxZ[l] = 0;
+        return;
+    }
+
+    quantizeLane(n.childBox(c), f, cn, l);
+}
+
+// the frame of the child in lane l: the box the queries decode
+static inline NodeFrame
+laneFrame(const CompressedNode& cn, size_t l, const NodeFrame& f) {
+    auto mn = f.origin + vec3(float(cn.qMinX[l]), float(cn.qMinY[l]), float(cn.qMinZ[l])) * f.step;
+    auto mx = f.origin + vec3(float(cn.qMaxX[l]), float(cn.qMaxY[l]), float(cn.qMaxZ[l])) * f.step;
+    return makeFrame(mn, mx);
+}
+
+void
+CollisionMesh::compressNodes() {
+    if (nodeFormat() == NodeFormat::COMPRESSED) return;
+    ownPools();
+
+    auto rootMin = vec3(std::numeric_limits<float>::max());
+    auto rootMax = vec3(-std::numeric_limits<float>::max());
+    const auto& root = nodes_[rootId_];
+    for (size_t c = 0; c < root.childCount; ++c) {
+        rootMin = glm::min(rootMin, root.childBox(c).min());
+        rootMax = glm::max(rootMax, root.childBox(c).max());
+    }
+
+    struct Pending {
+        uint32_t    wide;       // in nodes_
+        uint32_t    slot;       // in the compressed nodes
+        NodeFrame   frame;
+    };
+
+    CompressedNodePool compressed(1);
+    vector<uint32_t> leafIds(leaves_.size(), std::numeric_limits<uint32_t>::max());     // old leaf -> new leaf
+    uint32_t leafCount = 0;
+    vector<Pending> pending = { { uint32_t(rootId_), 0, makeFrame(rootMin, rootMax) } };
+
+    // depth first, the node children of a node get a contiguous block when the node is visited
+    while (!pending.empty()) {
+        auto p = pending.back();
+        pending.pop_back();
+
+        const auto& n = nodes_[p.wide];
+
+        size_t lanes[WideNode::WIDTH];
+
+        CompressedNode cn = CompressedNode();
+        cn.firstNode = uint32_t(compressed.size());
+        cn.firstLeaf = leafCount;
+        cn.nodeCount = uint8_t(compressedLanes(n, lanes));
+        cn.childCount = uint8_t(n.childCount);
+
+        auto firstPending = pending.size();
+        for (size_t l = 0; l < WideNode::WIDTH; ++l) {
+            quantizeLane(n, l < cn.childCount ? lanes[l] : 0, p.frame, cn, l);
+            if (l >= cn.childCount) continue;
+
+            auto c = lanes[l];
+            if (WideNode::isLeaf(n.child[c])) {
+                leafIds[WideNode::index(n.child[c])] = leafCount++;
+                continue;
+            }
+
+            // the child lanes are encoded in the box the queries will decode
+            pending.push_back({ n.child[c], uint32_t(compressed.size()), laneFrame(cn, l, p.frame) });
+            compressed.push_back(CompressedNode());
+        }
+
+        std::reverse(pending.begin() + firstPending, pending.end());   // first child on top
+        compressed[p.slot] = cn;
+    }
+
+    // renumber the leaves, the leaves replaced by the edits are dropped
+    vector<LeafRange> leaves(leafCount);
+    vector<AABB> leafBoxes(leafCount, emptyBox());
+    vector<LeafQuantization> quantization(quantization_.empty() ? 0 : leafCount);
+    vector<uint32_t> leafMeshlets(leafMeshlets_.empty() ? 0 : leafCount);
+    for (size_t i = 0; i < leaves_.size(); ++i) {
+        if (leafIds[i] == std::numeric_limits<uint32_t>::max()) continue;
+
+        leaves[leafIds[i]] = leaves_[i];
+        leafBoxes[leafIds[i]] = leafBoxes_[i];
+        if (!quantization_.empty()) quantization[leafIds[i]] = quantization_[i];
+        if (!leafMeshlets_.empty()) leafMeshlets[leafIds[i]] = leafMeshlets_[i];
+    }
+
+    leaves_.swap(leaves);
+    leafBoxes_.swap(leafBoxes);
+    quantization_.swap(quantization);
+    leafMeshlets_.swap(leafMeshlets);
+    compressedNodes_.swap(compressed);
+    NodePool().swap(nodes_);
+    rootId_ = 0;
+    rootBox_ = AABB(rootMin, rootMax);
+    refitMap_.reset();
+}
+
+// the exact boxes of the COMPRESSED nodes: the children come after their parent (see compressNodes),
+// walked backward a node merges the boxes of its children
+static vector<AABB>
+compressedNodeBoxes(ArrayView<CompressedNode> nodes, ArrayView<AABB> leafBoxes) {
+    vector<AABB> boxes(nodes.size(), emptyBox());
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        const auto& cn = nodes[i];
+        for (size_t l = 0; l < cn.childCount; ++l) {
+            auto child = cn.child(l);
+            boxes[i] = AABB::merge(boxes[i], WideNode::isLeaf(child) ? leafBoxes[WideNode::index(child)] : boxes[child]);
+        }
+    }
+    return boxes;
+}
+
+CollisionMesh::NodePool
+CollisionMesh::expandedNodes() const {
+    auto compressed = compressedNodes();
+    auto leafBoxes = this->leafBoxes();
+    auto boxes = compressedNodeBoxes(compressed, leafBoxes);
+
+    WideNode empty = WideNode();
+    for (size_t lane = 0; lane < WideNode::WIDTH; ++lane) {
+        setLane(empty, lane, emptyBox(), 0);
+    }
+    empty.childCount = 0;
+
+    NodePool nodes(compressed.size(), empty);
+    for (size_t i = 0; i < compressed.size(); ++i) {
+        const auto& cn = compressed[i];
+        for (size_t l = 0; l < cn.childCount; ++l) {
+            auto child = cn.child(l);
+            setLane(nodes[i], l, WideNode::isLeaf(child) ? leafBoxes[WideNode::index(child)] : boxes[child], child);
+        }
+        nodes[i].childCount = cn.childCount;
+    }
+    return nodes;
+}
+
+void
+CollisionMesh::expandNodes() {
+    if (nodeFormat() != NodeFormat::COMPRESSED || !nodes_.empty()) return;
+
+    nodes_ = expandedNodes();
+    rootId_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// refit: the tree shape, the leaf ranges and the block offsets stay, only the boxes and the leaf contents change
+//
+struct CollisionMesh::RefitMap {
+    vector<uint32_t>    nodeParents;    // the root is its own parent
+    vector<uint8_t>     nodeDepths;
+    vector<uint32_t>    leafParents;
+    vector<uint32_t>    triLeaves;      // source triangle -> leaf
+    vector<AABB>        nodeBoxes;      // COMPRESSED format only: the exact node boxes, the lanes are conservative
+};
+
+void
+CollisionMesh::buildRefitMap() {
+    bool compressed = nodeFormat() == NodeFormat::COMPRESSED;
+    auto nodeCount = compressed ? compressedNodes_.size() : nodes_.size();
+
+    auto map = std::make_shared<RefitMap>();
+    map->nodeParents.assign(nodeCount, uint32_t(rootId_));
+    map->nodeDepths.assign(nodeCount, 0);
+    map->leafParents.assign(leaves_.size(), uint32_t(rootId_));
+    map->triLeaves.assign(source_.triCount, 0);
+
+    vector<uint32_t> pending = { uint32_t(rootId_) };
+    while (!pending.empty()) {
+        auto n = pending.back();
+        pending.pop_back();
+
+        auto childCount = compressed ? size_t(compressedNodes_[n].childCount) : size_t(nodes_[n].childCount);
+        for (size_t c = 0; c < childCount; ++c) {
+            auto ref = compressed ? compressedNodes_[n].child(c) : nodes_[n].child[c];
+            auto child = WideNode::index(ref);
+            if (WideNode::isLeaf(ref)) {
+                map->leafParents[child] = n;
+                continue;
+            }
+
+            map->nodeParents[child] = n;
+            map->nodeDepths[child] = uint8_t(map->nodeDepths[n] + 1);
+            pending.push_back(child);
+        }
+    }
+
+    for (size_t l = 0; l < leaves_.size(); ++l) {
+        for (size_t t = leaves_[l].firstTri; t < size_t(leaves_[l].firstTri) + leaves_[l].triCount; ++t) {
+            map->triLeaves[triIds_[t]] = uint32_t(l);
+        }
+    }
+
+    if (compressed) map->nodeBoxes = compressedNodeBoxes(compressedNodes_, leafBoxes_);
+
+    refitMap_ = map;
+}
+
+static AABB
+leafBox(const TriPositions& tris, const vector<uint32_t>& ids, const CollisionMesh::LeafRange& leaf) {
+    auto box = emptyBox();
+    for (size_t t = leaf.firstTri; t < size_t(leaf.firstTri) + leaf.triCount; ++t) {
+        for (size_t c = 0; c < 3; ++c) {
+            auto p = tris(ids[t], c);
+            box = AABB(glm::min(box.min(), p), glm::max(box.max(), p));
+        }
+    }
+    return box;
+}
+
+// moves the meshlet vertices of a leaf to their corners, false if two corners sharing a vertex moved apart
+static bool
+moveMeshletVertices(const TriPositions& tris, const vector<uint32_t>& ids, const CollisionMesh::LeafRange& leaf, const CollisionMesh::Meshlet* m, const vector<uint8_t>& corners, vector<float>& vertices) {
+    for (size_t done = 0; done < leaf.triCount; done += m->triCount, ++m) {
+        uint64_t moved[CollisionMesh::MESHLET_VERTICES / 64] = { 0 };
+        auto v = vertices.data() + size_t(m->firstVertex) * 3;
+
+        for (size_t t = m->firstTri; t < size_t(m->firstTri) + m->triCount; ++t) {
+            for (size_t c = 0; c < 3; ++c) {
+                auto p = tris(ids[t], c);
+                auto k = corners[t * 3 + c];
+
+                if (moved[k / 64] & (uint64_t(1) << (k % 64))) {
+                    if (v[k * 3] != p.x || v[k * 3 + 1] != p.y || v[k * 3 + 2] != p.z) return false;
+                    continue;
+                }
+
+                v[k * 3] = p.x;
+                v[k * 3 + 1] = p.y;
+                v[k * 3 + 2] = p.z;
+                moved[k / 64] |= uint64_t(1) << (k % 64);
+            }
+        }
+    }
+    return true;
+}
+
+void
+CollisionMesh::refit(const std::vector<uint32_t>& dirtyTris, size_t threadCount) {
+    ownPools();
+    if (!refitMap_) buildRefitMap();
+
+    vector<uint8_t> dirty(leaves_.size(), 0);
+    vector<uint32_t> dirtyLeaves;
+    for (auto t : dirtyTris) {
+        auto l = refitMap_->triLeaves[t];
+        if (dirty[l]) continue;
+
+        dirty[l] = 1;
+        dirtyLeaves.push_back(l);
+    }
+
+    refitLeaves(dirtyLeaves, threadCount);
+}
+
+void
+CollisionMesh::refitAll(size_t threadCount) {
+    ownPools();
+
+    vector<uint32_t> dirtyLeaves;
+    for (size_t l = 0; l < leaves_.size(); ++l) {
+        if (leaves_[l].triCount > 0) dirtyLeaves.push_back(uint32_t(l));    // the others are empty or replaced by an edit
+    }
+
+    refitLeaves(dirtyLeaves, threadCount);
+}
+
+void
+CollisionMesh::refitLeaves(const std::vector<uint32_t>& dirtyLeaves, size_t threadCount) {
+    if (dirtyLeaves.empty()) return;
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    if (!refitMap_) buildRefitMap();
+
+    BuildContext ctx(0, threadCount);
+
+    size_t triCount = 0;
+    for (auto l : dirtyLeaves) {
+        triCount += leaves_[l].triCount;
+    }
+
+    // the leaves, each one only writes its own box and blocks
+    vector<uint8_t> splitMeshlets(dirtyLeaves.size(), 0);
+    parallelFor(ctx.chunkCount(triCount), dirtyLeaves.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto l = dirtyLeaves[i];
+            const auto& lr = leaves_[l];
+            leafBoxes_[l] = leafBox(source_, triIds_, lr);
+
+            switch (leafFormat_) {
+            case LeafFormat::QUANTIZED: quantization_[l] = quantizeLeaf(source_, triIds_, lr, quantizedBlocks_.data() + size_t(lr.firstBlock) * QBLOCK_VALUES); break;
+            case LeafFormat::MESHLETS:  splitMeshlets[i] = !moveMeshletVertices(source_, triIds_, lr, meshlets_.data() + leafMeshlets_[l], meshletCorners_, meshletVertices_); break;
+            default:                    packLeafRecords(source_, triIds_, lr, blocks_.data() + size_t(lr.firstBlock) * BLOCK_FLOATS); break;
+            }
+        }
+    });
+
+    if (leafFormat_ == LeafFormat::MESHLETS) {
+        MeshletVertices local(meshletVertices_);
+        for (size_t i = 0; i < dirtyLeaves.size(); ++i) {
+            if (!splitMeshlets[i]) continue;
+
+            leafMeshlets_[dirtyLeaves[i]] = uint32_t(meshlets_.size());
+            appendLeafMeshlets(source_, triIds_, leaves_[dirtyLeaves[i]], local, meshlets_, meshletCorners_.data());
+        }
+    }
+
+    refitNodes(dirtyLeaves, threadCount);
+}
+
+void
+CollisionMesh::refitNodes(const std::vector<uint32_t>& dirtyLeaves, size_t threadCount) {
+    auto& map = *refitMap_;
+    BuildContext ctx(0, threadCount);
+
+    bool compressed = nodeFormat() == NodeFormat::COMPRESSED;
+
+    // the ancestors of the dirty leaves, by depth
+    vector<uint8_t> dirtyNodes(map.nodeParents.size(), 0);
+    vector<vector<uint32_t>> levels;
+    for (auto l : dirtyLeaves) {
+        for (auto n = map.leafParents[l]; !dirtyNodes[n]; n = map.nodeParents[n]) {
+            dirtyNodes[n] = 1;
+            if (levels.size() <= map.nodeDepths[n]) levels.resize(map.nodeDepths[n] + 1);
+            levels[map.nodeDepths[n]].push_back(n);
+        }
+    }
+
+    // deepest level first, a node merges the lanes of its children: the nodes of a level are independent
+    for (size_t d = levels.size(); d-- > 0; ) {
+        const auto& level = levels[d];
+        parallelFor(ctx.chunkCount(level.size() * WideNode::WIDTH), level.size(), [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (compressed) {
+                    // the exact boxes, requantized below
+                    const auto& cn = compressedNodes_[level[i]];
+                    auto box = emptyBox();
+                    for (size_t l = 0; l < cn.childCount; ++l) {
+                        auto child = cn.child(l);
+                        box = AABB::merge(box, WideNode::isLeaf(child) ? leafBoxes_[WideNode::index(child)] : map.nodeBoxes[child]);
+                    }
+                    map.nodeBoxes[level[i]] = box;
+                    continue;
+                }
+
+                auto& node = nodes_[level[i]];
+                for (size_t c = 0; c < node.childCount; ++c) {
+                    auto child = WideNode::index(node.child[c]);
+                    if (WideNode::isLeaf(node.child[c])) {
+                        setLane(node, c, leafBoxes_[child], node.child[c]);
+                        continue;
+                    }
+
+                    const auto& n = nodes_[child];
+                    auto box = emptyBox();
+                    for (size_t cc = 0; cc < n.childCount; ++cc) {
+                        box = AABB::merge(box, n.childBox(cc));
+                    }
+                    setLane(node, c, box, node.child[c]);
+                }
+            }
+        });
+    }
+
+    if (compressed) requantizeNodes(dirtyNodes);
+}
+
+//
+// the compressed nodes are walked top down from the exact boxes of the refit map: a node is requantized when it is dirty
+// or when its frame moved, a frame moves when the parent frame moved or when the parent lane quantized differently
+//
+void
+CollisionMesh::requantizeNodes(const std::vector<uint8_t>& dirtyNodes) {
+    const auto& nodeBoxes = refitMap_->nodeBoxes;
+    const auto& rootBox = nodeBoxes[0];
+
+    struct Pending {
+        uint32_t    node;
+        NodeFrame   frame;
+        bool        moved;
+    };
+
+    bool rootMoved = rootBox.min() != rootBox_.min() || rootBox.max() != rootBox_.max();
+    rootBox_ = rootBox;
+
+    vector<Pending> pending = { { 0, makeFrame(rootBox.min(), rootBox.max()), rootMoved } };
+    while (!pending.empty()) {
+        auto p = pending.back();
+        pending.pop_back();
+
+        if (!p.moved && !dirtyNodes[p.node]) continue;
+
+        auto& cn = compressedNodes_[p.node];
+        for (size_t l = 0; l < cn.childCount; ++l) {
+            uint8_t old[6] = { cn.qMinX[l], cn.qMinY[l], cn.qMinZ[l], cn.qMaxX[l], cn.qMaxY[l], cn.qMaxZ[l] };
+            auto child = cn.child(l);
+            quantizeLane(WideNode::isLeaf(child) ? leafBoxes_[WideNode::index(child)] : nodeBoxes[child], p.frame, cn, l);
+            if (l >= cn.nodeCount) continue;
+
+            bool moved = p.moved || old[0] != cn.qMinX[l] || old[1] != cn.qMinY[l] || old[2] != cn.qMinZ[l]
+                                 || old[3] != cn.qMaxX[l] || old[4] != cn.qMaxY[l] || old[5] != cn.qMaxZ[l];
+            pending.push_back({ child, laneFrame(cn, l, p.frame), moved });
+        }
+    }
+}
+
+float
+CollisionMesh::sahCost() const {
+    auto expanded = nodeFormat() == NodeFormat::COMPRESSED ? expandedNodes() : NodePool();
+    auto nodes = expanded.empty() ? this->nodes() : ArrayView<WideNode>(expanded);
+
+    const auto& root = nodes[rootId_];
+    auto rootBox = emptyBox();
+    for (size_t c = 0; c < root.childCount; ++c) {
+        rootBox = AABB::merge(rootBox, root.childBox(c));
+    }
+
+    // a node visit tests the 8 lanes at once, a leaf tests its triangles: both weigh 1.
+    // Walked from the root, the pools may hold the garbage of the edits
+    float cost = AABB::area(rootBox);
+    vector<uint32_t> pending = { uint32_t(rootId_) };
+    while (!pending.empty()) {
+        const auto& n = nodes[pending.back()];
+        pending.pop_back();
+
+        for (size_t c = 0; c < n.childCount; ++c) {
+            auto leaf = WideNode::isLeaf(n.child[c]);
+            auto weight = leaf ? float(leaves()[WideNode::index(n.child[c])].triCount) : 1.0f;
+            cost += AABB::area(n.childBox(c)) * weight;
+            if (!leaf) pending.push_back(n.child[c]);
+        }
+    }
+
+    auto rootArea = AABB::area(rootBox);
+    return rootArea > 0.0f ? cost / rootArea : 0.0f;
+}
+
+float
+CollisionMesh::refitQuality() const {
+    auto cost = sahCost();
+    return cost > 0.0f ? builtSahCost_ / cost : 1.0f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// topology edits: the rebuilt subtrees are appended to the pools and take the place of the old ones in their parent,
+// the old nodes (no children) and leaves (no triangles) stay unreachable until compact()
+//
+static inline bool
+contains(const AABB& box, const vec3& p) {
+    return glm::all(glm::lessThanEqual(box.min(), p)) && glm::all(glm::lessThanEqual(p, box.max()));
+}
+
+// the subtree of child rebuilt with the inserted triangles, returns the reference of its new root.
+// The new leaves have no blocks yet, the caller packs them
+uint32_t
+CollisionMesh::rebuildSubtree(uint32_t child, size_t depth, const std::vector<uint32_t>& inserted, std::vector<uint32_t>& newLeaves, size_t threadCount) {
+    auto& map = *refitMap_;
+    bool isRoot = child == uint32_t(rootId_);
+    auto parent = WideNode::isLeaf(child) ? map.leafParents[WideNode::index(child)] : map.nodeParents[child];
+
+    // the triangles of the subtree
+    vector<uint32_t> tris(inserted);
+    vector<uint32_t> pending = { child };
+    while (!pending.empty()) {
+        auto c = pending.back();
+        pending.pop_back();
+
+        if (WideNode::isLeaf(c)) {
+            auto& lr = leaves_[WideNode::index(c)];
+            tris.insert(tris.end(), triIds_.begin() + lr.firstTri, triIds_.begin() + lr.firstTri + lr.triCount);
+            lr.triCount = 0;
+            leafBoxes_[WideNode::index(c)] = emptyBox();
+            continue;
+        }
+
+        auto& n = nodes_[c];
+        pending.insert(pending.end(), n.child, n.child + n.childCount);
+        n.childCount = 0;
+    }
+
+    // built apart on local ids, from the depth of the old subtree so MAX_DEPTH holds
+    BuildContext ctx(maxTriCountHint_, threadCount);
+    vector<AABB> boxes(tris.size(), emptyBox());
+    vector<uint32_t> ids(tris.size());
+    vector<uint32_t> scratch(buildMethod_ == BuildMethod::OCTREE ? tris.size() : 0);
+
+    for (size_t i = 0; i < tris.size(); ++i) {
+        auto v0 = source_(tris[i], 0);
+        auto v1 = source_(tris[i], 1);
+        auto v2 = source_(tris[i], 2);
+        boxes[i] = AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+        ids[i] = uint32_t(i);
+    }
+
+    FlatBuilder builder(ctx, boxes, ids, scratch);
+    FlatTree tree;
+    tree.reserve(1);
+
+    switch (buildMethod_) {
+    case BuildMethod::SAH:  builder.sah(tree, 0, 0, ids.size(), depth); break;
+    case BuildMethod::LBVH: buildLBVH(builder, tree, depth); break;
+    default:                builder.octree(tree, 0, 0, ids.size(), depth); break;
+    }
+
+    NodePool nodes;
+    vector<AABB> leafBoxes;
+    makeWideNodes(tree, nodes, leafBoxes);
+
+    auto nodeBase = uint32_t(nodes_.size());
+    auto leafBase = uint32_t(leaves_.size());
+    for (size_t l = 0; l < tree.leaves.size(); ++l) {
+        const auto& r = tree.leaves[l];
+        leaves_.push_back({ 0, uint32_t(triIds_.size()), r.end - r.begin });
+        leafBoxes_.push_back(leafBoxes[l]);
+        for (auto i = r.begin; i < r.end; ++i) {
+            triIds_.push_back(tris[ids[i]]);
+            map.triLeaves[tris[ids[i]]] = leafBase + uint32_t(l);
+        }
+        newLeaves.push_back(leafBase + uint32_t(l));
+    }
+
+    // a leaf root hangs from the parent lane, the root of the mesh is always a node
+    uint32_t root = WideNode::LEAF_BIT | leafBase;
+    if (tree.nodes[0].type() == AABBNode::Type::NODE || isRoot) {
+        for (auto& n : nodes) {
+            for (size_t c = 0; c < n.childCount; ++c) {
+                n.child[c] = WideNode::isLeaf(n.child[c]) ? WideNode::LEAF_BIT | (WideNode::index(n.child[c]) + leafBase) : n.child[c] + nodeBase;
+            }
+        }
+        nodes_.insert(nodes_.end(), nodes.begin(), nodes.end());
+        root = nodeBase;
+    }
+
+    // the refit map of the new nodes and leaves, the parents come first
+    map.nodeParents.resize(nodes_.size());
+    map.nodeDepths.resize(nodes_.size());
+    map.leafParents.resize(leaves_.size());
+    if (WideNode::isLeaf(root)) {
+        map.leafParents[leafBase] = parent;
+    } else {
+        map.nodeParents[root] = isRoot ? root : parent;
+        map.nodeDepths[root] = uint8_t(depth);
+    }
+
+    for (auto n = nodeBase; n < nodes_.size(); ++n) {
+        const auto& node = nodes_[n];
+        for (size_t c = 0; c < node.childCount; ++c) {
+            auto index = WideNode::index(node.child[c]);
+            if (WideNode::isLeaf(node.child[c])) {
+                map.leafParents[index] = n;
+                continue;
+            }
+            map.nodeParents[index] = n;
+            map.nodeDepths[index] = uint8_t(map.nodeDepths[n] + 1);
+        }
+    }
+
+    triCount_ += inserted.size();
+    return root;
+}
+
+void
+CollisionMesh::editTris(const TriPositions& source, const std::vector<uint32_t>& inserted, const std::vector<uint32_t>& removed, size_t threadCount) {
+    source_ = source;
+    editTris(inserted, removed, threadCount);
+}
+
+void
+CollisionMesh::editTris(const std::vector<uint32_t>& inserted, const std::vector<uint32_t>& removed, size_t threadCount) {
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    ownPools();
+    if (mesh_) source_ = TriPositions::of(*mesh_);
+    if (indexedMesh_) source_ = TriPositions::of(*indexedMesh_);
+
+    // the compressed nodes are made again once the wide nodes are edited
+    expandNodes();
+    bool compressed = nodeFormat() == NodeFormat::COMPRESSED;
+    CompressedNodePool().swap(compressedNodes_);
+
+    if (!refitMap_) buildRefitMap();
+    auto& map = *refitMap_;
+    map.triLeaves.resize(source_.triCount, 0);
+
+    auto parentOf = [&](uint32_t child) { return WideNode::isLeaf(child) ? map.leafParents[WideNode::index(child)] : map.nodeParents[child]; };
+
+    // every inserted triangle goes down the child its box grows the least, as long as the child holds its centroid
+    // or at most doubles its area: the deepest child reached is rebuilt
+    std::map<uint32_t, vector<uint32_t>> targets;
+    for (auto t : inserted) {
+        auto v0 = source_(t, 0);
+        auto v1 = source_(t, 1);
+        auto v2 = source_(t, 2);
+        auto box = AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+
+        auto target = uint32_t(rootId_);
+        while (!WideNode::isLeaf(target)) {
+            const auto& n = nodes_[target];
+            size_t best = WideNode::WIDTH;
+            float bestGrowth = std::numeric_limits<float>::max();
+            for (size_t c = 0; c < n.childCount; ++c) {
+                auto childBox = n.childBox(c);
+                auto area = AABB::area(childBox);
+                auto growth = AABB::area(AABB::merge(childBox, box)) - area;
+                if (growth < bestGrowth && (contains(childBox, centroid(box)) || growth <= area)) {
+                    bestGrowth = growth;
+                    best = c;
+                }
+            }
+            if (best == WideNode::WIDTH) break;
+            target = n.child[best];
+        }
+        targets[target].push_back(t);
+    }
+
+    // a target inside another one is rebuilt along with it
+    std::map<uint32_t, vector<uint32_t>> rebuilds;
+    for (const auto& t : targets) {
+        auto outer = t.first;
+        for (auto c = t.first; c != uint32_t(rootId_); ) {
+            c = parentOf(c);
+            if (targets.count(c)) outer = c;
+        }
+        auto& tris = rebuilds[outer];
+        tris.insert(tris.end(), t.second.begin(), t.second.end());
+    }
+
+    vector<uint32_t> newLeaves;
+    for (const auto& r : rebuilds) {
+        auto parent = parentOf(r.first);
+        auto depth = WideNode::isLeaf(r.first) ? size_t(map.nodeDepths[parent]) + 1 : size_t(map.nodeDepths[r.first]);
+        auto root = rebuildSubtree(r.first, depth, r.second, newLeaves, threadCount);
+
+        if (r.first == uint32_t(rootId_)) {
+            rootId_ = root;
+            continue;
+        }
+
+        auto& p = nodes_[parent];
+        for (size_t c = 0; c < p.childCount; ++c) {
+            if (p.child[c] == r.first) p.child[c] = root;
+        }
+    }
+
+    // the new leaves get their blocks at the end of the pools
+    vector<uint8_t> dirty(leaves_.size(), 0);
+    for (auto l : newLeaves) {
+        auto& lr = leaves_[l];
+        auto blockCount = (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+        switch (leafFormat_) {
+        case LeafFormat::QUANTIZED:
+            lr.firstBlock = uint32_t(quantizedBlocks_.size() / QBLOCK_VALUES);
+            quantizedBlocks_.resize(quantizedBlocks_.size() + blockCount * QBLOCK_VALUES);
+            break;
+        case LeafFormat::MESHLETS:
+            break;
+        default:
+            lr.firstBlock = uint32_t(blocks_.size() / BLOCK_FLOATS);
+            blocks_.resize(blocks_.size() + blockCount * BLOCK_FLOATS);
+            break;
+        }
+        dirty[l] = 1;
+    }
+    if (leafFormat_ == LeafFormat::QUANTIZED) quantization_.resize(leaves_.size());
+    if (leafFormat_ == LeafFormat::MESHLETS) {
+        leafMeshlets_.resize(leaves_.size());
+        meshletCorners_.resize(triIds_.size() * 3);
+    }
+
+    // the removed triangles leave their leaf, the last triangle of the leaf takes their place
+    vector<uint32_t> dirtyLeaves(newLeaves);
+    for (auto t : removed) {
+        if (t >= map.triLeaves.size()) continue;
+
+        auto l = map.triLeaves[t];
+        auto& lr = leaves_[l];
+        auto first = triIds_.begin() + lr.firstTri;
+        auto last = first + lr.triCount;
+        auto it = std::find(first, last, t);
+        if (it == last) continue;
+
+        *it = *(last - 1);
+        --lr.triCount;
+        --triCount_;
+        if (!dirty[l]) {
+            dirty[l] = 1;
+            dirtyLeaves.push_back(l);
+        }
+    }
+
+    // the dirty leaves repacked in the current format, the meshlets are made again
+    BuildContext ctx(0, threadCount);
+    size_t triCount = 0;
+    for (auto l : dirtyLeaves) {
+        triCount += leaves_[l].triCount;
+    }
+
+    parallelFor(ctx.chunkCount(triCount), dirtyLeaves.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto l = dirtyLeaves[i];
+            const auto& lr = leaves_[l];
+            leafBoxes_[l] = leafBox(source_, triIds_, lr);
+
+            switch (leafFormat_) {
+            case LeafFormat::QUANTIZED: quantization_[l] = quantizeLeaf(source_, triIds_, lr, quantizedBlocks_.data() + size_t(lr.firstBlock) * QBLOCK_VALUES); break;
+            case LeafFormat::MESHLETS:  break;
+            default:                    packLeafRecords(source_, triIds_, lr, blocks_.data() + size_t(lr.firstBlock) * BLOCK_FLOATS); break;
+            }
+        }
+    });
+
+    if (leafFormat_ == LeafFormat::MESHLETS) {
+        MeshletVertices local(meshletVertices_);
+        for (auto l : dirtyLeaves) {
+            leafMeshlets_[l] = uint32_t(meshlets_.size());
+            appendLeafMeshlets(source_, triIds_, leaves_[l], local, meshlets_, meshletCorners_.data());
+        }
+    }
+
+    refitNodes(dirtyLeaves, threadCount);
+
+    if (compressed) {
+        compact();
+        compressNodes();
+    }
+}
+
+void
+CollisionMesh::compact() {
+    ownPools();
+    expandNodes();
+
+    bool compressed = nodeFormat() == NodeFormat::COMPRESSED;
+    CompressedNodePool().swap(compressedNodes_);    // the leaves are renumbered, made again at the end
+
+    NodePool nodes(1);
+    vector<LeafRange> leaves;
+    vector<AABB> leafBoxes;
+    vector<uint32_t> triIds;
+    BlockPool blocks;
+    QuantizedPool quantizedBlocks;
+    vector<LeafQuantization> quantization;
+
+    size_t blockCount = 0;      // the replaced leaves have no triangles left
+    for (const auto& lr : leaves_) {
+        blockCount += (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+    }
+    triIds.reserve(triCount_);
+    if (leafFormat_ == LeafFormat::RECORDS) blocks.resize(blockCount * BLOCK_FLOATS);
+    if (leafFormat_ == LeafFormat::QUANTIZED) quantizedBlocks.resize(blockCount * QBLOCK_VALUES);
+    blockCount = 0;
+
+    struct Pending {
+        uint32_t    old;        // in nodes_
+        uint32_t    slot;       // in nodes
+    };
+
+    // depth first, the node children of a node get a contiguous block when the node is visited.
+    // The empty leaves are dropped from the lanes
+    vector<Pending> pending = { { uint32_t(rootId_), 0 } };
+    while (!pending.empty()) {
+        auto p = pending.back();
+        pending.pop_back();
+
+        const auto& n = nodes_[p.old];
+        WideNode w = WideNode();
+        for (size_t lane = 0; lane < WideNode::WIDTH; ++lane) {
+            setLane(w, lane, emptyBox(), 0);
+        }
+        w.childCount = 0;
+
+        auto firstPending = pending.size();
+        for (size_t c = 0; c < n.childCount; ++c) {
+            auto child = n.child[c];
+            if (!WideNode::isLeaf(child)) {
+                pending.push_back({ child, uint32_t(nodes.size()) });
+                setLane(w, w.childCount++, n.childBox(c), uint32_t(nodes.size()));
+                nodes.push_back(WideNode());
+                continue;
+            }
+
+            const auto& lr = leaves_[WideNode::index(child)];
+            if (lr.triCount == 0) continue;
+
+            auto leafBlocks = (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+            leaves.push_back({ uint32_t(blockCount), uint32_t(triIds.size()), lr.triCount });
+            leafBoxes.push_back(leafBoxes_[WideNode::index(child)]);
+            triIds.insert(triIds.end(), triIds_.begin() + lr.firstTri, triIds_.begin() + lr.firstTri + lr.triCount);
+
+            switch (leafFormat_) {
+            case LeafFormat::QUANTIZED:
+                std::copy_n(quantizedBlocks_.data() + size_t(lr.firstBlock) * QBLOCK_VALUES, leafBlocks * QBLOCK_VALUES, quantizedBlocks.data() + blockCount * QBLOCK_VALUES);
+                quantization.push_back(quantization_[WideNode::index(child)]);
+                break;
+            case LeafFormat::MESHLETS:
+                break;
+            default:
+                std::copy_n(blocks_.data() + size_t(lr.firstBlock) * BLOCK_FLOATS, leafBlocks * BLOCK_FLOATS, blocks.data() + blockCount * BLOCK_FLOATS);
+                break;
+            }
+            blockCount += leafBlocks;
+            setLane(w, w.childCount++, n.childBox(c), WideNode::LEAF_BIT | uint32_t(leaves.size() - 1));
+        }
+
+        std::reverse(pending.begin() + firstPending, pending.end());   // first child on top
+        nodes[p.slot] = w;
+    }
+
+    // the meshlets of the kept leaves, without the stale ones of the refits
+    if (leafFormat_ == LeafFormat::MESHLETS) {
+        vector<Meshlet> meshlets;
+        vector<uint32_t> leafMeshlets(leaves.size());
+        vector<float> vertices;
+        vector<uint8_t> corners(triIds.size() * 3);
+        MeshletVertices local(vertices);
+
+        for (size_t l = 0; l < leaves.size(); ++l) {
+            leafMeshlets[l] = uint32_t(meshlets.size());
+            appendLeafMeshlets(source_, triIds, leaves[l], local, meshlets, corners.data());
+        }
+
+        meshlets_.swap(meshlets);
+        leafMeshlets_.swap(leafMeshlets);
+        meshletVertices_.swap(vertices);
+        meshletCorners_.swap(corners);
+    }
+
+    rootId_ = 0;
+    nodes_.swap(nodes);
+    leaves_.swap(leaves);
+    leafBoxes_.swap(leafBoxes);
+    triIds_.swap(triIds);
+    blocks_.swap(blocks);
+    quantizedBlocks_.swap(quantizedBlocks);
+    quantization_.swap(quantization);
+    refitMap_.reset();
+
+    if (compressed) compressNodes();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// binary file: the header, then every pool as a section starting on a BLOCK_ALIGNMENT boundary (the mapping is page
+// aligned, so the sections keep the alignment of the pools). The sections are the pools byte for byte, the
+// references in them are indices: the file is relocatable and mapFrom only points the pools at the sections
+//
+struct CollisionMesh::FileHeader {
+    static const uint32_t   MAGIC = 0x4d435150u;   // "PQCM" in little endian
+    static const uint32_t   VERSION = 1;
+
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    simdWidth;      // the blocks are laid out by SIMD lanes
+    uint32_t    leafFormat;
+    uint32_t    buildMethod;
+    uint32_t    rootId;
+    float       rootBox[6];
+    uint64_t    triCount;
+    uint64_t    maxTriCountHint;
+    uint64_t    sourceTriCount;
+    float       builtSahCost;
+    uint32_t    indexed;        // the source has indices (SECTION_INDICES)
+    uint64_t    sections[SECTION_COUNT][2];    // byte offset and byte size
+};
+
+static_assert(sizeof(CollisionMesh::LeafRange) == 12 && sizeof(AABB) == 24 && sizeof(CollisionMesh::LeafQuantization) == 28 && sizeof(CollisionMesh::Meshlet) == 12,
+              "the file sections are the pools: a layout change needs a new FileHeader::VERSION");
+
+static inline bool
+littleEndian() {
+    const uint16_t one = 1;
+    return *reinterpret_cast<const uint8_t*>(&one) == 1;
+}
+
+static inline uint64_t
+alignSection(uint64_t offset) {
+    return (offset + CollisionMesh::BLOCK_ALIGNMENT - 1) & ~uint64_t(CollisionMesh::BLOCK_ALIGNMENT - 1);
+}
+
+template<typename T>
+static inline ArrayView<char>
+sectionOf(ArrayView<T> pool) {
+    return ArrayView<char>(reinterpret_cast<const char*>(pool.data()), pool.size() * sizeof(T));
+}
+
+template<typename T, typename A>
+static inline void
+assignPool(std::vector<T, A>& pool, ArrayView<T> section) {
+    pool.assign(section.begin(), section.end());
+}
+
+bool
+CollisionMesh::saveTo(const std::string& fileName) const {
+    if (!littleEndian()) {
+        cerr << "Error: the collision mesh files are little endian" << endl;
+        return false;
+    }
+
+    // the source positions packed as xyz floats, the indices as they are
+    auto indexCount = source_.triCount * 3;
+    size_t vertexCount = source_.indices ? 0 : indexCount;
+    for (size_t i = 0; source_.indices && i < indexCount; ++i) {
+        vertexCount = std::max<size_t>(vertexCount, size_t(source_.indices[i]) + 1);
+    }
+
+    vector<float> positions(vertexCount * 3);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        auto p = reinterpret_cast<const float*>(reinterpret_cast<const char*>(source_.positions) + v * source_.stride);
+        std::copy(p, p + 3, positions.begin() + v * 3);
+    }
+
+    ArrayView<char> sections[SECTION_COUNT];
+    sections[SECTION_NODES] = sectionOf(nodes());
+    sections[SECTION_COMPRESSED_NODES] = sectionOf(compressedNodes());
+    sections[SECTION_LEAVES] = sectionOf(leaves());
+    sections[SECTION_LEAF_BOXES] = sectionOf(leafBoxes());
+    sections[SECTION_BLOCKS] = sectionOf(blocks());
+    sections[SECTION_QUANTIZED_BLOCKS] = sectionOf(quantizedBlocks());
+    sections[SECTION_QUANTIZATION] = sectionOf(quantization());
+    sections[SECTION_MESHLETS] = sectionOf(meshlets());
+    sections[SECTION_LEAF_MESHLETS] = sectionOf(leafMeshlets());
+    sections[SECTION_MESHLET_VERTICES] = sectionOf(meshletVertices());
+    sections[SECTION_MESHLET_CORNERS] = sectionOf(meshletCorners());
+    sections[SECTION_TRI_IDS] = sectionOf(triIds());
+    sections[SECTION_POSITIONS] = sectionOf(ArrayView<float>(positions));
+    sections[SECTION_INDICES] = sectionOf(ArrayView<uint32_t>(source_.indices, source_.indices ? indexCount : 0));
+
+    FileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = FileHeader::MAGIC;
+    h.version = FileHeader::VERSION;
+    h.simdWidth = uint32_t(SIMD_WIDTH);
+    h.leafFormat = uint32_t(leafFormat_);
+    h.buildMethod = uint32_t(buildMethod_);
+    h.rootId = uint32_t(rootId_);
+    for (int a = 0; a < 3; ++a) {
+        h.rootBox[a] = rootBox_.min()[a];
+        h.rootBox[3 + a] = rootBox_.max()[a];
+    }
+    h.triCount = triCount_;
+    h.maxTriCountHint = maxTriCountHint_;
+    h.sourceTriCount = source_.triCount;
+    h.builtSahCost = builtSahCost_;
+    h.indexed = source_.indices ? 1 : 0;
+
+    auto offset = alignSection(sizeof(FileHeader));
+    for (size_t s = 0; s < SECTION_COUNT; ++s) {
+        h.sections[s][0] = offset;
+        h.sections[s][1] = sections[s].size();
+        offset = alignSection(offset + sections[s].size());
+    }
+
+    ofstream out(fileName, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    static const char padding[BLOCK_ALIGNMENT] = {};
+    uint64_t written = sizeof(h);
+    for (size_t s = 0; s < SECTION_COUNT; ++s) {
+        out.write(padding, std::streamsize(h.sections[s][0] - written));
+        out.write(sections[s].data(), std::streamsize(sections[s].size()));
+        written = h.sections[s][0] + sections[s].size();
+    }
+
+    // the buffered tail is only written by the close, a full disk fails there
+    out.close();
+    if (out.fail()) {
+        cerr << "Error: unable to write " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::mapFrom(const std::string& fileName) {
+    if (!littleEndian()) {
+        cerr << "Error: the collision mesh files are little endian" << endl;
+        return nullptr;
+    }
+
+    auto file = MappedFile::open(fileName);
+    if (file == nullptr) return nullptr;
+
+    const auto& h = *reinterpret_cast<const FileHeader*>(file->data());
+    if (file->size() < sizeof(FileHeader) || h.magic != FileHeader::MAGIC) {
+        cerr << "Error: " << fileName << " is not a collision mesh file" << endl;
+        return nullptr;
+    }
+
+    if (h.version != FileHeader::VERSION || h.simdWidth != SIMD_WIDTH) {
+        cerr << "Error: " << fileName << " is a version " << h.version << " collision mesh file for " << h.simdWidth << " SIMD lanes, expected version "
+             << FileHeader::VERSION << " for " << SIMD_WIDTH << " lanes" << endl;
+        return nullptr;
+    }
+
+    // only the section bounds are checked, the content is trusted
+    for (size_t s = 0; s < SECTION_COUNT; ++s) {
+        if (h.sections[s][0] % BLOCK_ALIGNMENT != 0 || h.sections[s][0] > file->size() || h.sections[s][1] > file->size() - h.sections[s][0]) {
+            cerr << "Error: " << fileName << " is truncated" << endl;
+            return nullptr;
+        }
+    }
+
+    auto section = [&](size_t s) { return ArrayView<char>(h.sections[s][1] ? file->data() + h.sections[s][0] : nullptr, size_t(h.sections[s][1])); };
+    auto positions = section(SECTION_POSITIONS);
+    auto indices = section(SECTION_INDICES);
+
+    auto sourceTriCount = size_t(h.sourceTriCount);
+    auto sourceOk = h.indexed ? indices.size() == sourceTriCount * 3 * sizeof(uint32_t) : positions.size() == sourceTriCount * 9 * sizeof(float);
+    auto compressed = section(SECTION_COMPRESSED_NODES);
+    auto nodeCount = compressed.empty() ? section(SECTION_NODES).size() / sizeof(WideNode) : compressed.size() / sizeof(CompressedNode);
+    if (!sourceOk || h.rootId >= nodeCount) {
+        cerr << "Error: " << fileName << " is truncated" << endl;
+        return nullptr;
+    }
+
+    TriPositions source = { reinterpret_cast<const float*>(positions.data()), 3 * sizeof(float), h.indexed ? reinterpret_cast<const uint32_t*>(indices.data()) : nullptr, sourceTriCount };
+
+    auto cm = Ptr(new CollisionMesh(h.rootId, NodePool(), vector<LeafRange>(), vector<AABB>(), BlockPool(), vector<uint32_t>(), source));
+    cm->rootBox_ = AABB(vec3(h.rootBox[0], h.rootBox[1], h.rootBox[2]), vec3(h.rootBox[3], h.rootBox[4], h.rootBox[5]));
+    cm->leafFormat_ = LeafFormat(h.leafFormat);
+    cm->triCount_ = size_t(h.triCount);
+    cm->maxTriCountHint_ = size_t(h.maxTriCountHint);
+    cm->buildMethod_ = BuildMethod(h.buildMethod);
+    cm->builtSahCost_ = h.builtSahCost;
+    cm->file_ = file;
+    for (size_t s = 0; s < SECTION_COUNT; ++s) {
+        cm->sections_[s] = section(s);
+    }
+
+    // a COMPRESSED mesh has no float nodes, the files saved along with them map without them
+    if (!compressed.empty()) {
+        cm->sections_[SECTION_NODES] = ArrayView<char>();
+        cm->rootId_ = 0;
+    }
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::mapFrom(const std::string& fileName, TriMesh::Ptr source) {
+    auto cm = mapFrom(fileName);
+    if (cm == nullptr || !cm->attachSource(TriPositions::of(*source), fileName)) return nullptr;
+    cm->mesh_ = source;
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::mapFrom(const std::string& fileName, IndexedTriMesh::Ptr source) {
+    auto cm = mapFrom(fileName);
+    if (cm == nullptr || !cm->attachSource(TriPositions::of(*source), fileName)) return nullptr;
+    cm->indexedMesh_ = source;
+    return cm;
+}
+
+CollisionMesh::Ptr
+CollisionMesh::mapFrom(const std::string& fileName, const TriPositions& source) {
+    auto cm = mapFrom(fileName);
+    if (cm == nullptr || !cm->attachSource(source, fileName)) return nullptr;
+    return cm;
+}
+
+bool
+CollisionMesh::attachSource(const TriPositions& source, const std::string& fileName) {
+    if (source.triCount != source_.triCount) {
+        cerr << "Error: " << fileName << " holds " << source_.triCount << " source triangles, not " << source.triCount << endl;
+        return false;
+    }
+
+    source_ = source;
+    return true;
+}
+
+bool
+CollisionMesh::sourceMatchesFile() const {
+    const auto& positions = sections_[SECTION_POSITIONS];
+    const auto& indices = sections_[SECTION_INDICES];
+    if (file_ == nullptr || (positions.empty() && source_.triCount > 0)) return false;
+
+    TriPositions saved = { reinterpret_cast<const float*>(positions.data()), 3 * sizeof(float), indices.empty() ? nullptr : reinterpret_cast<const uint32_t*>(indices.data()), source_.triCount };
+    for (size_t t = 0; t < source_.triCount; ++t) {
+        for (size_t c = 0; c < 3; ++c) {
+            auto a = saved(t, c);
+            auto b = source_(t, c);
+            if (memcmp(&a, &b, sizeof(a)) != 0) return false;
+        }
+    }
+    return true;
+}
+
+// copy on write of a mapped mesh: the pools leave the file before they change, the source positions stay mapped
+void
+CollisionMesh::ownPools() {
+    bool mapped = false;
+    for (const auto& s : sections_) {
+        mapped = mapped || s.data() != nullptr;
+    }
+    if (!mapped) return;
+
+    assignPool(nodes_, nodes());
+    assignPool(compressedNodes_, compressedNodes());
+    assignPool(leaves_, leaves());
+    assignPool(leafBoxes_, leafBoxes());
+    assignPool(blocks_, blocks());
+    assignPool(quantizedBlocks_, quantizedBlocks());
+    assignPool(quantization_, quantization());
+    assignPool(meshlets_, meshlets());
+    assignPool(leafMeshlets_, leafMeshlets());
+    assignPool(meshletVertices_, meshletVertices());
+    assignPool(meshletCorners_, meshletCorners());
+    assignPool(triIds_, triIds());
+
+    for (auto& s : sections_) {
+        s = ArrayView<char>();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Note: the query functions below are the hot path, they must neither allocate nor copy a shared pointer
+// (atomic reference counting doesn't scale with the thread count). Everything is accessed through const references.
+//
+
+// squared distances from the point to the children boxes of a wide node, infinite for the unused lanes
+static inline SimdFloat8
+childSqDistances(const WideNode& node, SimdFloat8 px, SimdFloat8 py, SimdFloat8 pz) {
+    auto zero = simdSet8(0.0f);
+    auto dx = simdMax(simdMax(simdLoad8(node.minX) - px, px - simdLoad8(node.maxX)), zero);
+    auto dy = simdMax(simdMax(simdLoad8(node.minY) - py, py - simdLoad8(node.maxY)), zero);
+    auto dz = simdMax(simdMax(simdLoad8(node.minZ) - pz, pz - simdLoad8(node.maxZ)), zero);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+//
+// node access of the traversals, they are templates over the node format:
+// - load() returns the node of a node reference, a COMPRESSED node is decoded in tmp (its lanes dequantized in its frame)
+// - the frame of a node is its box as the parent lanes decode it, carried along the traversal. The WIDE nodes
+//   have their bounds in place and an empty frame
+//
+struct WideNodes {
+    struct Frame {};
+
+    static const WideNode&  load(const CollisionMesh& cm, uint32_t child, const Frame&, WideNode&) { return cm.nodes()[child]; }
+    static Frame            childFrame(const WideNode&, size_t) { return Frame(); }
+    static uint32_t         root(const CollisionMesh& cm) { return uint32_t(cm.rootId()); }
+    static Frame            rootFrame(const CollisionMesh&) { return Frame(); }
+};
+
+struct CompressedNodes {
+    typedef NodeFrame   Frame;
+
+    static const WideNode&
+    load(const CollisionMesh& cm, uint32_t child, const Frame& frame, WideNode& tmp) {
+        const auto& cn = cm.compressedNodes()[child];
+        auto ox = simdSet8(frame.origin.x);
+        auto oy = simdSet8(frame.origin.y);
+        auto oz = simdSet8(frame.origin.z);
+        auto sx = simdSet8(frame.step.x);
+        auto sy = simdSet8(frame.step.y);
+        auto sz = simdSet8(frame.step.z);
+
+        simdStore(tmp.minX, ox + simdLoadU8x8(cn.qMinX) * sx);
+        simdStore(tmp.minY, oy + simdLoadU8x8(cn.qMinY) * sy);
+        simdStore(tmp.minZ, oz + simdLoadU8x8(cn.qMinZ) * sz);
+        simdStore(tmp.maxX, ox + simdLoadU8x8(cn.qMaxX) * sx);
+        simdStore(tmp.maxY, oy + simdLoadU8x8(cn.qMaxY) * sy);
+        simdStore(tmp.maxZ, oz + simdLoadU8x8(cn.qMaxZ) * sz);
+
+        for (size_t i = 0; i < cn.childCount; ++i) {
+            tmp.child[i] = cn.child(i);
+        }
+        tmp.childCount = cn.childCount;
+        return tmp;
+    }
+
+    static Frame
+    childFrame(const WideNode& node, size_t i) {
+        return makeFrame(vec3(node.minX[i], node.minY[i], node.minZ[i]), vec3(node.maxX[i], node.maxY[i], node.maxZ[i]));
+    }
+
+    static uint32_t root(const CollisionMesh&) { return 0; }
+    static Frame    rootFrame(const CollisionMesh& cm) { return makeFrame(cm.rootBox().min(), cm.rootBox().max()); }
+};
+
+// child is a node or a leaf reference (see WideNode), its box is already known to touch the sphere
+template<typename Nodes>
+static glm::vec3
+closest(uint32_t child, const typename Nodes::Frame& frame, const CollisionMesh& cm, const glm::vec3& pt, float radius, int& leaf, size_t& tri) {
+    int minLeaf = std::numeric_limits<int>::max();
+    size_t minTri = 0;
+    vec3  minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+
+    if (WideNode::isLeaf(child)) {
+        auto sqDist = radius * radius;
+        if (closestOnLeaf(cm, WideNode::index(child), pt, sqDist, minPt, minTri)) {
+            minLeaf = static_cast<int>(WideNode::index(child));
+        }
+    } else { // a node, loop through all the children touching the sphere
+        WideNode tmp;
+        const auto& node = Nodes::load(cm, child, frame, tmp);
+
+        float sqDists[WideNode::WIDTH];
+        simdStore(sqDists, childSqDistances(node, simdSet8(pt.x), simdSet8(pt.y), simdSet8(pt.z)));
+
+        float minDist = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < node.childCount; ++i) {
+            if (!(sqDists[i] < radius * radius)) continue;
+
+            int subLeaf;
+            size_t subTri;
+            auto clpt = closest<Nodes>(node.child[i], Nodes::childFrame(node, i), cm, pt, radius, subLeaf, subTri);
+            auto dist = glm::length(clpt - pt);
+            if (dist < minDist && dist < radius) {
+                minDist = dist;
+                minPt = clpt;
+                minLeaf = subLeaf;
+                minTri = subTri;
+            }
+        }
+    }
+
+    leaf = minLeaf;
+    tri = minTri;
+    return minPt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// best first (branch and bound) traversal:
+// - pending children are kept in a min heap ordered by their box distance to the point
+// - the search radius shrinks to the closest distance found so far
+// - as soon as the nearest pending box is further than the best distance, nothing left can beat it
+// - the heap lives on the stack: when it is full, the child subtree is searched depth first right away
+//   (with the current best distance as radius) instead of being queued
+//
+// the frame is a base: it takes no room when empty
+template<typename Frame>
+struct Candidate : Frame {
+    float       sqDist;     // squared distance from the query point to the child box
+    uint32_t    child;
+
+    Candidate() {}
+    Candidate(float d, uint32_t c, const Frame& frame) : Frame(frame), sqDist(d), child(c) {}
+
+    const Frame&    frame() const { return *this; }
+
+    bool operator > (const Candidate& other) const { return sqDist > other.sqDist; }
+};
+
+static const size_t MAX_PENDING = CollisionMesh::MAX_DEPTH * WideNode::WIDTH;
+
+template<typename Nodes>
+static glm::vec3
+closestBestFirst(const CollisionMesh& cm, const glm::vec3& pt, float radius, int& leaf, size_t& tri) {
+    typedef Candidate<typename Nodes::Frame> Pending;
+
+    int minLeaf = std::numeric_limits<int>::max();
+    size_t minTri = 0;
+    float minSqDist = radius * radius;
+    vec3  minPt(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+
+    auto px = simdSet8(pt.x);
+    auto py = simdSet8(pt.y);
+    auto pz = simdSet8(pt.z);
+
+    Pending     pending[MAX_PENDING];
+    size_t      pendingCount = 0;
+
+    pending[pendingCount++] = Pending(0.0f, Nodes::root(cm), Nodes::rootFrame(cm));  // the root children are tested right away
+
+    while (pendingCount > 0) {
+        auto top = pending[0];
+        if (top.sqDist >= minSqDist) break;    // the nearest pending box can't improve the result
+        std::pop_heap(pending, pending + pendingCount, greater<Pending>());
+        --pendingCount;
+
+        if (WideNode::isLeaf(top.child)) {
+            if (closestOnLeaf(cm, WideNode::index(top.child), pt, minSqDist, minPt, minTri)) {
+                minLeaf = static_cast<int>(WideNode::index(top.child));
+            }
+            continue;
+        }
+
+        WideNode tmp;
+        const auto& node = Nodes::load(cm, top.child, top.frame(), tmp);
+
+        float sqDists[WideNode::WIDTH];
+        simdStore(sqDists, childSqDistances(node, px, py, pz));
+
+        for (size_t i = 0; i < node.childCount; ++i) {
+            if (sqDists[i] >= minSqDist) continue;
+
+            if (pendingCount < MAX_PENDING) {
+                pending[pendingCount++] = Pending(sqDists[i], node.child[i], Nodes::childFrame(node, i));
+                std::push_heap(pending, pending + pendingCount, greater<Pending>());
+            } else {
+                int subLeaf;
+                size_t subTri;
+                auto clpt = closest<Nodes>(node.child[i], Nodes::childFrame(node, i), cm, pt, std::sqrt(minSqDist), subLeaf, subTri);
+                auto d = clpt - pt;
+                if (subLeaf != std::numeric_limits<int>::max() && glm::dot(d, d) < minSqDist) {
+                    minSqDist = glm::dot(d, d);
+                    minPt = clpt;
+                    minLeaf = subLeaf;
+                    minTri = subTri;
+                }
+            }
+        }
+    }
+
+    leaf = minLeaf;
+    tri = minTri;
+    return minPt;
+}
+
+glm::vec3
+ProximityQuery::closestPointOnMesh(const glm::vec3& pt, float radius, int& leaf) const {
+    int tri;
+    return closestPointOnMesh(pt, radius, leaf, tri);
+}
+
+glm::vec3
+ProximityQuery::closestPointOnMesh(const glm::vec3& pt, float radius, int& leaf, int& tri) const {
+    size_t minTri;
+    vec3 minPt;
+    if (cm_->nodeFormat() == CollisionMesh::NodeFormat::COMPRESSED) {
+        minPt = traversal_ == Traversal::BEST_FIRST ? closestBestFirst<CompressedNodes>(*cm_, pt, radius, leaf, minTri)
+                                                    : closest<CompressedNodes>(0, CompressedNodes::rootFrame(*cm_), *cm_, pt, radius, leaf, minTri);
+    } else {
+        minPt = traversal_ == Traversal::BEST_FIRST ? closestBestFirst<WideNodes>(*cm_, pt, radius, leaf, minTri)
+                                                    : closest<WideNodes>(uint32_t(cm_->rootId()), WideNodes::Frame(), *cm_, pt, radius, leaf, minTri);
+    }
+
+    // the attribute stream is only touched for the winner
+    tri = leaf != std::numeric_limits<int>::max() ? int(cm_->triIds()[minTri]) : std::numeric_limits<int>::max();
+    return minPt;
+}
+
+glm::vec3
+ProximityQuery::closestPointOnMesh(const glm::vec3& pt, int& leaf) const {
+    size_t tri;
+    return cm_->nodeFormat() == CollisionMesh::NodeFormat::COMPRESSED ? closestBestFirst<CompressedNodes>(*cm_, pt, std::numeric_limits<float>::infinity(), leaf, tri)
+                                                                      : closestBestFirst<WideNodes>(*cm_, pt, std::numeric_limits<float>::infinity(), leaf, tri);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// packet traversal: PACKET_SIZE points walk the tree together
+// - the lanes are stored as structure of arrays, the per lane loops are simple enough to be vectorized
+// - a child is entered if any active lane still touches its box, each lane keeps its own shrinking radius
+// - the children are pushed far to near (nearest for the packet on top)
+//
+const size_t ProximityQuery::PACKET_SIZE;   // std::min binds it to a reference: it needs a definition
+
+struct Packet {
+    float   x[ProximityQuery::PACKET_SIZE];
+    float   y[ProximityQuery::PACKET_SIZE];
+    float   z[ProximityQuery::PACKET_SIZE];
+    float   sqRadius[ProximityQuery::PACKET_SIZE];  // shrinks to the best squared distance found so far
+    vec3    minPt[ProximityQuery::PACKET_SIZE];
+    int     minLeaf[ProximityQuery::PACKET_SIZE];
+    size_t  count;                                  // active lanes (the last packet can be partial)
+};
+
+static inline void
+packetSqDistances(const AABB& bbox, const Packet& p, float* sqDist) {
+    auto mn = bbox.min();
+    auto mx = bbox.max();
+    for (size_t i = 0; i < ProximityQuery::PACKET_SIZE; ++i) {
+        auto dx = std::max(std::max(mn.x - p.x[i], p.x[i] - mx.x), 0.0f);
+        auto dy = std::max(std::max(mn.y - p.y[i], p.y[i] - mx.y), 0.0f);
+        auto dz = std::max(std::max(mn.z - p.z[i], p.z[i] - mx.z), 0.0f);
+        sqDist[i] = dx * dx + dy * dy + dz * dz;
+    }
+}
+
+// returns the smallest squared distance among the lanes still touching the box, or max float if none do
+static inline float
+packetHit(const AABB& bbox, const Packet& p, bool* hit) {
+    float sqDist[ProximityQuery::PACKET_SIZE];
+    packetSqDistances(bbox, p, sqDist);
+
+    auto minSqDist = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < ProximityQuery::PACKET_SIZE; ++i) {
+        hit[i] = i < p.count && sqDist[i] < p.sqRadius[i];
+        if (hit[i]) minSqDist = std::min(minSqDist, sqDist[i]);
+    }
+    return minSqDist;
+}
+
+template<typename Nodes>
+static void
+closestPacket(const CollisionMesh& cm, Packet& p) {
+    typedef Candidate<typename Nodes::Frame> Pending;
+
+    Pending     stack[CollisionMesh::MAX_DEPTH * (WideNode::WIDTH - 1) + 1];
+    size_t      top = 0;
+    bool        hit[ProximityQuery::PACKET_SIZE];
+
+    stack[top++] = Pending(0.0f, Nodes::root(cm), Nodes::rootFrame(cm));
+
+    while (top > 0) {
+        auto child = stack[--top].child;
+
+        if (!WideNode::isLeaf(child)) {
+            WideNode tmp;
+            const auto& node = Nodes::load(cm, child, stack[top].frame(), tmp);
+
+            // one SIMD sequence per point for all the children, each child keeps the nearest point still touching it
+            float childMin[WideNode::WIDTH];
+            for (size_t c = 0; c < WideNode::WIDTH; ++c) {
+                childMin[c] = std::numeric_limits<float>::max();
+            }
+
+            for (size_t i = 0; i < p.count; ++i) {
+                float sqDists[WideNode::WIDTH];
+                simdStore(sqDists, childSqDistances(node, simdSet8(p.x[i]), simdSet8(p.y[i]), simdSet8(p.z[i])));
+                for (size_t c = 0; c < WideNode::WIDTH; ++c) {
+                    if (sqDists[c] < p.sqRadius[i]) childMin[c] = std::min(childMin[c], sqDists[c]);
+                }
+            }
+
+            Pending children[WideNode::WIDTH];
+            size_t childCount = 0;
+            for (size_t c = 0; c < node.childCount; ++c) {
+                if (childMin[c] != std::numeric_limits<float>::max()) {
+                    children[childCount++] = Pending(childMin[c], node.child[c], Nodes::childFrame(node, c));
+                }
+            }
+
+            // far to near, an insertion sort: at most WideNode::WIDTH children
+            for (size_t i = 1; i < childCount; ++i) {
+                auto c = children[i];
+                auto j = i;
+                for (; j > 0 && c > children[j - 1]; --j) {
+                    children[j] = children[j - 1];
+                }
+                children[j] = c;
+            }
+
+            for (size_t i = 0; i < childCount; ++i) {
+                stack[top++] = children[i];
+            }
+        } else {
+            auto leaf = WideNode::index(child);
+            if (packetHit(cm.leafBoxes()[leaf], p, hit) == std::numeric_limits<float>::max()) continue;  // the radii might have shrunk since the push
+
+            if (cm.leafFormat() != CollisionMesh::LeafFormat::RECORDS) {
+                // the records are rebuilt per point, the leaf data stays in L1 for the whole packet
+                for (size_t i = 0; i < p.count; ++i) {
+                    size_t tri;
+                    if (hit[i] && closestOnLeaf(cm, leaf, vec3(p.x[i], p.y[i], p.z[i]), p.sqRadius[i], p.minPt[i], tri)) {
+                        p.minLeaf[i] = static_cast<int>(leaf);
+                    }
+                }
+                continue;
+            }
+
+            const auto& lr = cm.leaves()[leaf];
+            auto blockCount = (lr.triCount + SIMD_WIDTH - 1) / SIMD_WIDTH;
+
+            // block outer loop: each block of triangles is loaded once for the whole packet
+            for (size_t b = 0; b < blockCount; ++b) {
+                auto block = cm.blocks().data() + (lr.firstBlock + b) * CollisionMesh::BLOCK_FLOATS;
+                auto r = loadBlockRecord(block);
+
+                for (size_t i = 0; i < p.count; ++i) {
+                    if (!hit[i]) continue;
+
+                    SimdFloat s, t;
+                    auto sqDist = sqDistToTri(r, { simdSet(p.x[i]), simdSet(p.y[i]), simdSet(p.z[i]) }, s, t);
+                    auto blockMin = simdHMin(sqDist);
+                    if (blockMin < p.sqRadius[i]) {
+                        float sqDists[SIMD_WIDTH];
+                        simdStore(sqDists, sqDist);
+
+                        size_t lane = 0;
+                        while (sqDists[lane] != blockMin) ++lane;
+
+                        p.sqRadius[i] = blockMin;
+                        p.minPt[i] = closestOnLane(block, lane, vec3(p.x[i], p.y[i], p.z[i]));
+                        p.minLeaf[i] = static_cast<int>(leaf);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+ProximityQuery::closestPointsOnMesh(size_t count, const glm::vec3* pts, const float* radii, glm::vec3* outPts, float* outDists, int* outLeaves) const {
+    Packet p;
+
+    for (size_t base = 0; base < count; base += PACKET_SIZE) {
+        p.count = std::min(PACKET_SIZE, count - base);
+
+        for (size_t i = 0; i < PACKET_SIZE; ++i) {
+            auto src = base + std::min(i, p.count - 1);     // pad the partial packet with its last point
+            p.x[i] = pts[src].x;
+            p.y[i] = pts[src].y;
+            p.z[i] = pts[src].z;
+            p.sqRadius[i] = radii ? radii[src] * radii[src] : std::numeric_limits<float>::infinity();
+            p.minPt[i] = vec3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+            p.minLeaf[i] = std::numeric_limits<int>::max();
+        }
+
+        if (cm_->nodeFormat() == CollisionMesh::NodeFormat::COMPRESSED) {
+            closestPacket<CompressedNodes>(*cm_, p);
+        } else {
+            closestPacket<WideNodes>(*cm_, p);
+        }
+
+        for (size_t i = 0; i < p.count; ++i) {
+            outPts[base + i] = p.minPt[i];
+            outDists[base + i] = p.minLeaf[i] != std::numeric_limits<int>::max() ? std::sqrt(p.sqRadius[i]) : std::numeric_limits<float>::max();
+            outLeaves[base + i] = p.minLeaf[i];
+        }
+    }
 }
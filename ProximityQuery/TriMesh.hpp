@@ -39,10 +39,14 @@
 #include <memory>
 #include <cstdint>
 #include <limits>
+#include <string>
 
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtx/intersect.hpp>
 
+#include "Simd.hpp"
+#include "MappedFile.hpp"
+
 
 struct Segment {
     Segment(glm::vec3 start, glm::vec3 end) : start_(start), end_(end) {}
@@ -74,6 +78,15 @@ struct AABB {
         return AABB(mn, mx);
     }
 
+    static inline AABB merge(const AABB& a, const AABB& b) {
+        return AABB(glm::min(a.min_, b.min_), glm::max(a.max_, b.max_));
+    }
+
+    static inline float area(const AABB& bbox) {   // surface area, 0 for an empty (inverted) box
+        auto d = glm::max(bbox.max_ - bbox.min_, glm::vec3(0.0f));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     static inline bool overlap(const AABB& a, const AABB& b) {
         if (a.max_.x < b.min_.x) return false;
         if (a.max_.y < b.min_.y) return false;
@@ -88,6 +101,7 @@ struct AABB {
 
     // Classic Graphcis Gems 2
     static bool  intersectSphere(const AABB& bbox, const glm::vec3& center, float radius);
+    static float sqDistance(const AABB& bbox, const glm::vec3& pt);   // 0 when pt is inside the box
     static void  subdivide(const AABB& bbox, std::vector<AABB>& outBoxes);
 
 private:
@@ -140,7 +154,7 @@ struct TriMesh {
     const AABB&         bbox() const { return bbox_; }
     const std::vector<Tri>&     tris() const { return tris_; }
 
-    static glm::vec3    closestOnMesh(TriMesh::Ptr mesh, const glm::vec3& pt);
+    static glm::vec3    closestOnMesh(const TriMesh& mesh, const glm::vec3& pt);
 
 private:
     std::vector<Tri>    tris_;
@@ -148,50 +162,169 @@ private:
 };
 
 //
-// AABBNode : what is going to be called lvariant in C++1z (algeabric data type)
+// Indexed triangle mesh: the vertices are shared by the triangles, 3 indices per triangle.
+// A closed mesh has about half as many vertices as triangles: 40 bytes per vertex plus 12 per triangle
+// instead of 120 per triangle for the TriMesh soup
 //
-struct AABBNode {
-    enum class Type {
-        NODE,
-        LEAF
+struct IndexedTriMesh {
+    typedef std::shared_ptr<IndexedTriMesh> Ptr;
+    typedef TriMesh::Vertex                 Vertex;
+
+    enum class Weld {
+        NONE,       // keep the vertices as they are
+        EXACT,      // merge the vertices with the same position, normal and color
+        POSITIONS   // merge the vertices with the same position, the first one keeps its normal and color
     };
 
-    const AABB& bbox() const { return bbox_; }
-    Type        type() const { return type_; }
+    const AABB&                     bbox() const { return bbox_; }     // of the vertices
+    const std::vector<Vertex>&      vertices() const { return vertices_; }
+    const std::vector<uint32_t>&    indices() const { return indices_; }
+    size_t                          triCount() const { return indices_.size() / 3; }
 
-    const glm::vec4&    color() const { return color_; }
+    // moves a vertex (sculpting), the box only grows. Refit the collision meshes built from this mesh afterwards
+    void                            setPosition(size_t vertex, const glm::vec3& position) {
+        vertices_[vertex].position = position;
+        bbox_ = AABB(glm::min(bbox_.min(), position), glm::max(bbox_.max(), position));
+    }
 
-    struct Node;
-    struct Leaf;
+    //
+    // topology edits: a new triangle gets the next id, a removed triangle keeps its id as a degenerate triangle
+    // (its corners on its first vertex) so the other ids stay valid. addTri doesn't check the indices.
+    // Edit the collision meshes built from this mesh afterwards (CollisionMesh::editTris)
+    //
+    uint32_t                        addVertex(const Vertex& v) {
+        vertices_.push_back(v);
+        bbox_ = AABB(glm::min(bbox_.min(), v.position), glm::max(bbox_.max(), v.position));
+        return uint32_t(vertices_.size() - 1);
+    }
 
-protected:
-    AABBNode(const AABB& bbox, Type type) : bbox_(bbox), type_(type) {}
+    uint32_t                        addTri(uint32_t v0, uint32_t v1, uint32_t v2) {
+        indices_.insert(indices_.end(), { v0, v1, v2 });
+        return uint32_t(triCount() - 1);
+    }
 
-    glm::vec4   color_;
-    AABB        bbox_;
-    Type        type_;
-    size_t      index_[8];  // children or leaf index
-};
+    void                            removeTri(size_t t) { indices_[t * 3 + 1] = indices_[t * 3 + 2] = indices_[t * 3]; }
 
-struct AABBNode::Node : public AABBNode {
-    Node(const AABB& bbox, size_t children[]) : AABBNode(bbox, Type::NODE) {
-        for (size_t i = 0; i < 8; ++i) {
-            index_[i] = children[i];
-        }
+    // the triangle t expanded, for the attributes lookups
+    TriMesh::Tri                    tri(size_t t) const {
+        TriMesh::Tri tri;
+        for (size_t c = 0; c < 3; ++c) tri.v[c] = vertices_[indices_[t * 3 + c]];
+        return tri;
     }
 
-    size_t      operator[] (size_t i) const { return index_[i]; }
+    // null if indices is not made of triangles or references a missing vertex, the welding drops the unused vertices
+    static Ptr      create(std::vector<Vertex>&& vertices, std::vector<uint32_t>&& indices, Weld weld = Weld::NONE);
+
+private:
+    IndexedTriMesh(std::vector<Vertex>&& vertices, std::vector<uint32_t>&& indices, const AABB& bbox)
+        : vertices_(std::move(vertices)), indices_(std::move(indices)), bbox_(bbox) {}
+
+    std::vector<Vertex>     vertices_;
+    std::vector<uint32_t>   indices_;
+    AABB                    bbox_;
 };
 
-struct AABBNode::Leaf : public AABBNode {
-    Leaf(const AABB& bbox, size_t triMesh, const glm::vec4& color) : AABBNode(bbox, Type::LEAF) {
-        color_ = color;
-        index_[0] = triMesh;
+//
+// The triangle positions of a mesh, without a copy: a soup (indices is null, the corners of a triangle follow
+// each other) or a vertex buffer and 3 indices per triangle. stride is the byte distance between 2 positions.
+// The view doesn't own anything
+//
+struct TriPositions {
+    const float*        positions;
+    size_t              stride;
+    const uint32_t*     indices;
+    size_t              triCount;
+
+    glm::vec3           operator()(size_t tri, size_t corner) const {
+        auto i = indices ? size_t(indices[tri * 3 + corner]) : tri * 3 + corner;
+        auto p = reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + i * stride);
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+
+    static TriPositions of(const TriMesh& mesh) {
+        return { mesh.tris().empty() ? nullptr : &mesh.tris()[0].v[0].position.x, sizeof(TriMesh::Vertex), nullptr, mesh.tris().size() };
     }
 
-    size_t     triMesh() const { return index_[0]; }
+    static TriPositions of(const IndexedTriMesh& mesh) {
+        return { mesh.vertices().empty() ? nullptr : &mesh.vertices()[0].position.x, sizeof(IndexedTriMesh::Vertex), mesh.indices().data(), mesh.triCount() };
+    }
 };
 
+//
+// Read only view of an array: the pools of a collision mesh are its own vectors or sections of a mapped file
+//
+template<typename T>
+struct ArrayView {
+    ArrayView() : data_(nullptr), size_(0) {}
+    ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+    template<typename A> ArrayView(const std::vector<T, A>& v) : data_(v.data()), size_(v.size()) {}
+
+    const T*        data() const { return data_; }
+    size_t          size() const { return size_; }
+    bool            empty() const { return size_ == 0; }
+    const T&        operator[](size_t i) const { return data_[i]; }
+    const T*        begin() const { return data_; }
+    const T*        end() const { return data_ + size_; }
+
+private:
+    const T*        data_;
+    size_t          size_;
+};
+
+//
+// Wide node: the bounds of the (up to 8) children are stored in the node as structure of arrays lanes,
+// so all the children boxes are tested with one SIMD sequence and a child is only loaded when it is entered
+// - a child is a node (index in nodes()) or a leaf (LEAF_BIT | index in leaves())
+// - the unused lanes have empty (inverted) bounds, they never hit
+// - 256 bytes: 4 cache lines, aligned on a cache line
+//
+struct alignas(64) WideNode {
+    static const size_t     WIDTH = 8;
+    static const uint32_t   LEAF_BIT = 0x80000000u;
+
+    float       minX[WIDTH];
+    float       minY[WIDTH];
+    float       minZ[WIDTH];
+    float       maxX[WIDTH];
+    float       maxY[WIDTH];
+    float       maxZ[WIDTH];
+    uint32_t    child[WIDTH];
+    uint32_t    childCount;
+
+    AABB        childBox(size_t i) const { return AABB(glm::vec3(minX[i], minY[i], minZ[i]), glm::vec3(maxX[i], maxY[i], maxZ[i])); }
+
+    static bool     isLeaf(uint32_t child) { return (child & LEAF_BIT) != 0; }
+    static uint32_t index(uint32_t child) { return child & ~LEAF_BIT; }
+};
+
+static_assert(sizeof(WideNode) == 256, "a wide node must be 4 cache lines");
+
+//
+// Compressed wide node (see CollisionMesh::compressNodes): the children bounds are 8 bits per axis, conservative
+// offsets inside the node box. The node box itself is not stored, it is decoded from the parent lanes (the root box
+// is the only full precision box) and carried along by the traversal
+// - a lane decodes to box.min + q * (box.max - box.min) / 254, 255 is past the box max so rounding stays conservative
+// - the node children come first and are contiguous (firstNode...), then the leaf children (firstLeaf...)
+// - 64 bytes: one cache line
+//
+struct alignas(64) CompressedNode {
+    uint8_t     qMinX[WideNode::WIDTH];
+    uint8_t     qMinY[WideNode::WIDTH];
+    uint8_t     qMinZ[WideNode::WIDTH];
+    uint8_t     qMaxX[WideNode::WIDTH];
+    uint8_t     qMaxY[WideNode::WIDTH];
+    uint8_t     qMaxZ[WideNode::WIDTH];
+    uint32_t    firstNode;      // in compressedNodes()
+    uint32_t    firstLeaf;      // in leaves()
+    uint8_t     nodeCount;
+    uint8_t     childCount;
+
+    // same references as WideNode::child
+    uint32_t    child(size_t i) const { return i < nodeCount ? firstNode + uint32_t(i) : WideNode::LEAF_BIT | (firstLeaf + uint32_t(i - nodeCount)); }
+};
+
+static_assert(sizeof(CompressedNode) == 64, "a compressed node must be 1 cache line");
+
 //
 // Cache friendly collision mesh: This is done by building a bounding box tree and keeping leaves and nodes separate.
 // - the nodes are lightweight structures and the whole table is kept in L1 or L2 cache.
@@ -201,28 +334,329 @@ struct AABBNode::Leaf : public AABBNode {
 struct CollisionMesh {
     typedef std::shared_ptr<CollisionMesh> Ptr;
 
+    // deeper boxes are turned into leaves: this bounds the traversal stacks (WideNode::WIDTH children per level)
+    static const size_t             MAX_DEPTH = 32;
+
+    //
+    // the leaf triangles used by the queries, as structure of arrays of precomputed query records:
+    // - a record is the triangle origin and edges plus the dot products/inverses of the Voronoi region test (16 floats)
+    // - blocks of SIMD_WIDTH triangles, a block is BLOCK_STREAMS streams of SIMD_WIDTH floats (one per record field)
+    // - all the blocks are in one cache line aligned pool, ordered by leaf. A leaf owns a contiguous range of blocks,
+    //   its last block is padded by repeating its last triangle
+    // - the pool is positions only: triIds() maps the leaf triangles to the source mesh triangles (normals, colors),
+    //   only the closest triangle of a query is looked up there
+    //
+    static const size_t             BLOCK_STREAMS = 16;
+    static const size_t             BLOCK_FLOATS = BLOCK_STREAMS * SIMD_WIDTH;
+    static const size_t             BLOCK_ALIGNMENT = 64;
+
+    typedef std::vector<float, AlignedAllocator<float, BLOCK_ALIGNMENT>> BlockPool;
+    typedef std::vector<uint16_t, AlignedAllocator<uint16_t, BLOCK_ALIGNMENT>> QuantizedPool;
+    typedef std::vector<WideNode, AlignedAllocator<WideNode, BLOCK_ALIGNMENT>> NodePool;
+    typedef std::vector<CompressedNode, AlignedAllocator<CompressedNode, BLOCK_ALIGNMENT>> CompressedNodePool;
+
+    struct LeafRange {
+        uint32_t    firstBlock;     // in blocks() (or quantizedBlocks())
+        uint32_t    firstTri;       // in triIds()
+        uint32_t    triCount;
+    };
+
+    //
+    // compressed leaves (see quantizeLeaves): the vertex positions are 16 bits integers relative to the leaf bounds,
+    // blocks of SIMD_WIDTH triangles made of QBLOCK_STREAMS streams (v0.xyz, v1.xyz, v2.xyz) of SIMD_WIDTH values.
+    // A position is origin + q * scale, at most error away from the source vertex
+    //
+    static const size_t             QBLOCK_STREAMS = 9;
+    static const size_t             QBLOCK_VALUES = QBLOCK_STREAMS * SIMD_WIDTH;
+
+    struct LeafQuantization {
+        glm::vec3   origin;
+        glm::vec3   scale;
+        float       error;
+    };
+
+    //
+    // meshlet leaves (see makeMeshlets): a leaf is split in meshlets of at most MESHLET_VERTICES distinct vertices,
+    // the triangle corners are 8 bits indices in the meshlet vertices. The corners are in leaf order, 3 per triangle
+    // (the triangle at triIds()[i] has its corners at meshletCorners()[3 * i]). The meshlets of a leaf are contiguous
+    //
+    static const size_t             MESHLET_VERTICES = 256;
+
+    struct Meshlet {
+        uint32_t    firstVertex;    // in meshletVertices(), xyz floats
+        uint32_t    firstTri;       // in triIds()
+        uint32_t    triCount;
+    };
+
+    enum class LeafFormat {
+        RECORDS,    // precomputed float query records in blocks(): 64 bytes per triangle
+        QUANTIZED,  // quantized positions in quantizedBlocks(): 18 bytes per triangle, the query records are rebuilt on the fly
+        MESHLETS    // shared vertices and 8 bits corners: 3 bytes per triangle plus 12 per distinct vertex, exact
+    };
+
+    enum class NodeFormat {
+        WIDE,       // float child bounds in nodes()
+        COMPRESSED  // 8 bits child bounds in compressedNodes(), the root (index 0) is decoded in rootBox(). nodes() is empty
+    };
+
+    // the pools are in the mesh or in its mapped file (see mapFrom)
     size_t                          rootId() const { return rootId_; }
-    const std::vector<AABBNode>&    nodes() const { return nodes_; }
-    const std::vector<TriMesh::Ptr>&  leaves() const { return leaves_; }
+    ArrayView<WideNode>             nodes() const { return pool(nodes_, SECTION_NODES); }
+    ArrayView<CompressedNode>       compressedNodes() const { return pool(compressedNodes_, SECTION_COMPRESSED_NODES); }
+    const AABB&                     rootBox() const { return rootBox_; }
+    NodeFormat                      nodeFormat() const { return compressedNodes().empty() ? NodeFormat::WIDE : NodeFormat::COMPRESSED; }
+    ArrayView<LeafRange>            leaves() const { return pool(leaves_, SECTION_LEAVES); }
+    ArrayView<AABB>                 leafBoxes() const { return pool(leafBoxes_, SECTION_LEAF_BOXES); }
+    ArrayView<float>                blocks() const { return pool(blocks_, SECTION_BLOCKS); }
+    ArrayView<uint16_t>             quantizedBlocks() const { return pool(quantizedBlocks_, SECTION_QUANTIZED_BLOCKS); }
+    ArrayView<LeafQuantization>     quantization() const { return pool(quantization_, SECTION_QUANTIZATION); }
+    ArrayView<Meshlet>              meshlets() const { return pool(meshlets_, SECTION_MESHLETS); }
+    ArrayView<uint32_t>             leafMeshlets() const { return pool(leafMeshlets_, SECTION_LEAF_MESHLETS); }
+    ArrayView<float>                meshletVertices() const { return pool(meshletVertices_, SECTION_MESHLET_VERTICES); }
+    ArrayView<uint8_t>              meshletCorners() const { return pool(meshletCorners_, SECTION_MESHLET_CORNERS); }
+    LeafFormat                      leafFormat() const { return leafFormat_; }
+    ArrayView<uint32_t>             triIds() const { return pool(triIds_, SECTION_TRI_IDS); }
+    TriMesh::Ptr                    mesh() const { return mesh_; }                  // null unless built from a soup
+    IndexedTriMesh::Ptr             indexedMesh() const { return indexedMesh_; }    // null unless built from an indexed mesh
+    MappedFile::Ptr                 file() const { return file_; }                  // null unless mapped
+    const TriPositions&             source() const { return source_; }              // the source mesh positions
+
+    // the source mesh triangle with its attributes (normals, colors). Built from positions only,
+    // the normals are the face normal and the color is 0
+    TriMesh::Tri                    sourceTri(size_t tri) const;
+
+    enum class BuildMethod {
+        OCTREE,     // split the box in 8 equal octants: fast, but lopsided on non uniform triangle densities
+        SAH,        // binned surface area heuristic: 3 levels of binary splits make the 8 children of a node
+        LBVH        // sorted Morton codes of the triangle centroids: linear time, for very large meshes
+    };
 
-    static Ptr      build(TriMesh::Ptr orig, size_t maxTriCountHint);
+    // threadCount = 0 uses all the hardware threads, the result doesn't depend on the thread count
+    static Ptr      build(TriMesh::Ptr orig, size_t maxTriCountHint, BuildMethod method = BuildMethod::OCTREE, size_t threadCount = 0);
+    static Ptr      build(IndexedTriMesh::Ptr orig, size_t maxTriCountHint, BuildMethod method = BuildMethod::OCTREE, size_t threadCount = 0);
+
+    //
+    // zero copy build from caller owned buffers (a soup or indexed positions, see TriPositions): nothing but the view is
+    // kept, the buffers must outlive the collision mesh and stay unchanged. The RECORDS leaves are self contained,
+    // the other leaf formats and sourceTri() read the buffers. The indices must be in range.
+    // Null on a null positions pointer or a stride smaller than 3 floats
+    //
+    static Ptr      build(const TriPositions& source, size_t maxTriCountHint, BuildMethod method = BuildMethod::OCTREE, size_t threadCount = 0);
+
+    //
+    // a coarser collision mesh derived from this one, without building again: every subtree holding at most
+    // maxTriCountHint triangles becomes a leaf, the nodes above are kept. A linear pass, so a mesh built once with
+    // the smallest hint gives the larger ones cheaply. The builders split the same way whatever the hint: unless the
+    // mesh was edited, the result is the tree a build with maxTriCountHint would make. New RECORDS leaves and WIDE
+    // nodes over the same source, the post passes apply as after a build
+    //
+    Ptr             collapse(size_t maxTriCountHint, size_t threadCount = 0) const;
+
+    //
+    // optional post pass, cache oblivious node order: the nodes are regrouped in treelets of treeletBytes (a page
+    // by default). A treelet is the breadth first top of a subtree, the subtrees hanging below it make the next
+    // treelets (depth first). The hot top levels stay together and a descent touches few pages/cache lines.
+    // The root stays first. A COMPRESSED mesh keeps its depth first order. Not thread safe: reorder before querying the mesh
+    //
+    void            reorderNodes(size_t treeletBytes = 4096);
+
+    //
+    // optional post pass, switch from the RECORDS to the QUANTIZED leaf format (about 3.5x the triangles per cache line).
+    // The queries stay exact: a leaf triangle is only a candidate if its quantized distance minus the leaf error
+    // can beat the best distance, the candidates are then refined with the full precision source triangles.
+    // The record blocks are freed. Not thread safe: quantize before querying the mesh
+    //
+    void            quantizeLeaves();
+
+    //
+    // optional post pass, switch from the RECORDS to the MESHLETS leaf format: the vertices shared by the leaf
+    // triangles are loaded once (a closed mesh has about half as many vertices as triangles). The kernel gathers
+    // the corners and rebuilds the query records on the fly. The record blocks are freed. Not thread safe
+    //
+    void            makeMeshlets();
+
+    //
+    // optional post pass, switch to the COMPRESSED node format: 64 bytes nodes instead of 256, the node table of a
+    // multi-million triangles mesh fits in L2. The wide nodes are freed: the root box is the only float box left
+    // (leafBoxes() aside). The leaves are renumbered so the leaf children of a node are contiguous. The decoded boxes
+    // are conservative: the queries stay exact, they only enter a few more children. Not thread safe: compress before
+    // querying the mesh
+    //
+    void            compressNodes();
+
+    //
+    // refit after the source positions moved in place (same triangles, see IndexedTriMesh::setPosition or the
+    // caller buffers of a TriPositions build): the leaves holding the dirty triangles (source mesh ids) get their
+    // box and their triangles repacked in the current leaf format, then the ancestor boxes are merged bottom up.
+    // The dirty leaves are refit in parallel, then every tree level in parallel (deepest first).
+    // - the tree shape is kept: the queries stay exact but slow down as the boxes stretch, see refitQuality()
+    // - the COMPRESSED nodes are requantized top down, only where a box or a decoding frame changed. Their exact bounds
+    //   are merged from leafBoxes() by the first refit and kept with the refit map (24 bytes per node)
+    // - a meshlet whose shared corners moved apart is rebuilt at the end of the meshlet pools, the old one is dropped
+    // Not thread safe: refit between the queries
+    //
+    void            refit(const std::vector<uint32_t>& dirtyTris, size_t threadCount = 0);
+    void            refitAll(size_t threadCount = 0);      // every triangle moved
+
+    //
+    // topology edits, a partial rebuild: inserted are new source triangle ids, removed are the triangles to drop
+    // (their ids may stay in the source, see IndexedTriMesh::removeTri).
+    // - a removed triangle leaves its leaf, the leaf is repacked and its ancestors refit
+    // - an inserted triangle goes down the child its box grows the least, while that child holds its centroid or
+    //   at most doubles its area. The deepest child reached (a leaf or a node) is rebuilt with the inserted triangles,
+    //   with the build method and leaf size of the mesh, and appended to the pools. The rest is kept as is
+    // - new geometry far from the mesh rebuilds from the root
+    // The replaced nodes, leaves and blocks stay behind in the pools (see fragmentation() and compact()).
+    // The source view is refreshed from the source mesh (it may have grown), a caller buffers mesh passes its new view.
+    // A COMPRESSED mesh is compacted and compressed again (linear time). Not thread safe: edit between the queries
+    //
+    void            editTris(const std::vector<uint32_t>& inserted, const std::vector<uint32_t>& removed, size_t threadCount = 0);
+    void            editTris(const TriPositions& source, const std::vector<uint32_t>& inserted, const std::vector<uint32_t>& removed, size_t threadCount = 0);
+
+    size_t          triCount() const { return triCount_; }     // the triangles in the leaves
+
+    // the share of triIds() left behind by the edits, compact() when it gets high
+    float           fragmentation() const { return triIds_.empty() ? 0.0f : 1.0f - float(triCount_) / float(triIds_.size()); }
+
+    // the nodes, leaves and leaf pools rewritten depth first without the garbage of the edits and refits,
+    // the node children are contiguous again. Not thread safe
+    void            compact();
+
+    // surface area heuristic cost: expected node visits plus triangle tests of a query, relative to the root box area
+    float           sahCost() const;
+
+    //
+    // binary file of the collision mesh, its layout is the in memory layout: the pools are written as they are
+    // (64 bytes aligned sections, indices rather than pointers) after a versioned header, with the source positions.
+    // The file is little endian and tied to the SIMD_WIDTH of the writer (the blocks are laid out by SIMD lanes).
+    // False on a write error
+    //
+    bool            saveTo(const std::string& fileName) const;
+
+    //
+    // the collision mesh of a saveTo file, mapped read only and queried in place: nothing is parsed or copied,
+    // the pages are loaded as the queries touch them. Built from positions only (see sourceTri), the source is in
+    // the file. The first post pass, refit or edit copies the pools out of the file (the source positions stay mapped).
+    // Null on an error: not a collision mesh file, another version or SIMD_WIDTH, a big endian host or a truncated file
+    //
+    static Ptr      mapFrom(const std::string& fileName);
+
+    //
+    // same, over the source the file was saved from (the same triangles, in the same order): the source attributes are
+    // used (see sourceTri) and the source positions are read from it, the file positions are left alone.
+    // Null if the triangle counts differ
+    //
+    static Ptr      mapFrom(const std::string& fileName, TriMesh::Ptr source);
+    static Ptr      mapFrom(const std::string& fileName, IndexedTriMesh::Ptr source);
+    static Ptr      mapFrom(const std::string& fileName, const TriPositions& source);
+
+    // true if the file positions (see saveTo) are the source positions, corner for corner and bit for bit: linear in
+    // the triangles. False unless mapped, or once the pools left the file (see mapFrom)
+    bool            sourceMatchesFile() const;
+
+    // the cost after the build over the current cost: 1 after a build, it drops as the refits stretch the boxes
+    // (and as the surface grows: a rebuild can't undo that part). A rebuild usually pays off around 0.5
+    float           refitQuality() const;
 
 private:
-    CollisionMesh(size_t rootId, const std::vector<AABBNode>& nodes, const std::vector<TriMesh::Ptr>& leaves) : rootId_(rootId), nodes_(nodes), leaves_(leaves) {}
-    size_t                      rootId_;    // given the way it's built right now, it's the last element! this might change however in the future
-    std::vector<AABBNode>       nodes_;
-    std::vector<TriMesh::Ptr>   leaves_;
+    CollisionMesh(size_t rootId, NodePool&& nodes, std::vector<LeafRange>&& leaves, std::vector<AABB>&& leafBoxes, BlockPool&& blocks, std::vector<uint32_t>&& triIds, const TriPositions& source)
+        : rootId_(rootId), nodes_(std::move(nodes)), rootBox_(glm::vec3(0.0f), glm::vec3(0.0f)), leaves_(std::move(leaves)), leafBoxes_(std::move(leafBoxes)), blocks_(std::move(blocks)), leafFormat_(LeafFormat::RECORDS), triIds_(std::move(triIds)), source_(source), triCount_(source.triCount)
+        , maxTriCountHint_(0), buildMethod_(BuildMethod::OCTREE), builtSahCost_(0.0f) {}
+
+    // the parents and depths of the nodes and the leaf of every triangle, made by the first refit or edit
+    struct RefitMap;
+
+    // the pools in file order, see saveTo
+    enum Section {
+        SECTION_NODES, SECTION_COMPRESSED_NODES, SECTION_LEAVES, SECTION_LEAF_BOXES, SECTION_BLOCKS, SECTION_QUANTIZED_BLOCKS, SECTION_QUANTIZATION,
+        SECTION_MESHLETS, SECTION_LEAF_MESHLETS, SECTION_MESHLET_VERTICES, SECTION_MESHLET_CORNERS, SECTION_TRI_IDS, SECTION_POSITIONS, SECTION_INDICES, SECTION_COUNT
+    };
+
+    struct FileHeader;
+
+    // the mapped section of a pool, or the pool itself
+    template<typename T, typename A>
+    ArrayView<T>    pool(const std::vector<T, A>& owned, Section section) const {
+        const auto& s = sections_[section];
+        return s.data() ? ArrayView<T>(reinterpret_cast<const T*>(s.data()), s.size() / sizeof(T)) : ArrayView<T>(owned);
+    }
+
+    void            ownPools();
+
+    // the float nodes of a COMPRESSED mesh, merged bottom up from leafBoxes(): same indices as compressedNodes() and
+    // the lanes in their order. They only live for the duration of an edit or a compact
+    NodePool        expandedNodes() const;
+    void            expandNodes();
+
+    bool            attachSource(const TriPositions& source, const std::string& fileName);
+
+    void            buildRefitMap();
+    void            refitLeaves(const std::vector<uint32_t>& dirtyLeaves, size_t threadCount);
+    void            refitNodes(const std::vector<uint32_t>& dirtyLeaves, size_t threadCount);
+    void            requantizeNodes(const std::vector<uint8_t>& dirtyNodes);
+    uint32_t        rebuildSubtree(uint32_t child, size_t depth, const std::vector<uint32_t>& inserted, std::vector<uint32_t>& newLeaves, size_t threadCount);
+
+    size_t                      rootId_;    // the first node, the children of a node follow it (until an edit)
+    NodePool                    nodes_;     // empty for the COMPRESSED format (but in a refit or an edit)
+    CompressedNodePool          compressedNodes_;   // empty for the WIDE format
+    AABB                        rootBox_;
+    std::vector<LeafRange>      leaves_;
+    std::vector<AABB>           leafBoxes_; // also in the parent lanes, kept apart for the packet queries and the rendering
+    BlockPool                   blocks_;
+    LeafFormat                  leafFormat_;
+    QuantizedPool               quantizedBlocks_;
+    std::vector<LeafQuantization>   quantization_;  // per leaf, QUANTIZED format only
+    std::vector<Meshlet>        meshlets_;
+    std::vector<uint32_t>       leafMeshlets_;      // first meshlet of every leaf, MESHLETS format only
+    std::vector<float>          meshletVertices_;
+    std::vector<uint8_t>        meshletCorners_;
+    std::vector<uint32_t>       triIds_;    // source mesh triangle of every leaf triangle, in leaf order
+    TriPositions                source_;    // points in mesh_ or indexedMesh_
+    TriMesh::Ptr                mesh_;      // the source mesh, attributes of the leaf triangles (rendering, normals)
+    IndexedTriMesh::Ptr         indexedMesh_;
+    size_t                      triCount_;
+    size_t                      maxTriCountHint_;   // the build parameters, for the partial rebuilds
+    BuildMethod                 buildMethod_;
+    float                       builtSahCost_;
+    std::shared_ptr<RefitMap>   refitMap_;  // null until the first refit or edit, reset by the node/leaf renumbering
+    MappedFile::Ptr             file_;      // the mapped file of the sections and of the source positions
+    ArrayView<char>             sections_[SECTION_COUNT];  // empty once the pools are owned
 };
 
 struct ProximityQuery {
     typedef std::shared_ptr<ProximityQuery> Ptr;
 
+    enum class Traversal {
+        DEPTH_FIRST,    // visit every child touching the query sphere
+        BEST_FIRST      // visit the nearest box first and shrink the radius to the best distance found so far
+    };
+
+    // leaf is the index (in leaves()) of the leaf holding the closest point, or max int if nothing is within radius
     glm::vec3       closestPointOnMesh(const glm::vec3& pt, float radius, int& leaf) const;
 
-    static Ptr      create(CollisionMesh::Ptr triMesh) { return Ptr(new ProximityQuery(triMesh)); }
+    // same, tri is the closest triangle in the source mesh (collision mesh sourceTri(tri) holds its attributes), max int if none
+    glm::vec3       closestPointOnMesh(const glm::vec3& pt, float radius, int& leaf, int& tri) const;
+
+    // unbounded query: always best first, only fails (max int leaf) on an empty mesh
+    glm::vec3       closestPointOnMesh(const glm::vec3& pt, int& leaf) const;
+
+    //
+    // batch query: the tree is walked with packets of PACKET_SIZE points, so every node box is loaded
+    // once per packet instead of once per point. Coherent points (close to each other in the arrays) make
+    // better packets. radii can be null for unbounded queries, the out arrays are allocated by the caller
+    // and hold count elements. Points with nothing in range get max float coordinates/distance and max int leaf
+    //
+    static const size_t PACKET_SIZE = 8;
+
+    void            closestPointsOnMesh(size_t count, const glm::vec3* pts, const float* radii, glm::vec3* outPts, float* outDists, int* outLeaves) const;
+
+    Traversal       traversal() const { return traversal_; }
+
+    static Ptr      create(CollisionMesh::Ptr triMesh, Traversal traversal = Traversal::BEST_FIRST) { return Ptr(new ProximityQuery(triMesh, traversal)); }
 
 private:
 
-    ProximityQuery(CollisionMesh::Ptr mesh) : cm_(mesh) {}
+    ProximityQuery(CollisionMesh::Ptr mesh, Traversal traversal) : cm_(mesh), traversal_(traversal) {}
     CollisionMesh::Ptr  cm_;
+    Traversal           traversal_;
 };
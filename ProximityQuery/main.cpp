@@ -18,6 +18,8 @@
 
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <algorithm>
 
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
@@ -29,6 +31,8 @@
 #include <GLFW/glfw3.h>
 
 #include "TriMesh.hpp"
+#include "BuildCache.hpp"
+#include "QueryExecutor.hpp"
 #include "ObjLoader.hpp"
 #include "Render.hpp"
 
@@ -41,6 +45,7 @@ using namespace glm;
 using namespace std;
 
 #define INITIAL_MAX_TRI_COUNT 32.0f
+#define MIN_MAX_TRI_COUNT 4.0f      // the finest tree, the slider values are collapsed from it
 
 struct MainUi {
     vec3        pointSphericalCoordinates;  // point spherical coordinates
@@ -56,6 +61,14 @@ struct MainUi {
     bool        useCollisionMeshView;       // use collision mesh view for rendering (debugging)
     bool        testBoxSubdiv;              // checkbox for box subdivision test
     bool        showLeaves;                 // show collision mesh view leaves (debugging)
+    bool        sahBuilder;                 // build the collision mesh with the SAH builder instead of the octree
+    bool        lbvhBuilder;                // build the collision mesh with the Morton code builder instead of the octree
+    bool        treeletOrder;               // reorder the collision mesh nodes in page sized treelets
+    bool        quantizedLeaves;            // 16 bits leaf vertex positions instead of float query records
+    bool        compressedNodes;            // 8 bits child bounds instead of float
+    bool        meshletLeaves;              // shared leaf vertices and 8 bits corner indices instead of float query records
+
+    BuildCache::Ptr buildCache;             // finest trees by mesh content, a reload maps the stored tree
 
     static MainUi   create(float radius) {
         return {
@@ -72,8 +85,43 @@ struct MainUi {
             true,                       // useCollisionMeshView
             false,                      // testBoxSubdiv
             true,                       // showLeaves
+            false,                      // sahBuilder
+            false,                      // lbvhBuilder
+            false,                      // treeletOrder
+            false,                      // quantizedLeaves
+            false,                      // compressedNodes
+            false,                      // meshletLeaves
+
+            BuildCache::create("cache"),    // buildCache
         };
     }
+
+    CollisionMesh::BuildMethod buildMethod() const {
+        if (lbvhBuilder) return CollisionMesh::BuildMethod::LBVH;
+        return sahBuilder ? CollisionMesh::BuildMethod::SAH : CollisionMesh::BuildMethod::OCTREE;
+    }
+
+    CollisionMesh::Ptr buildCollisionMesh(IndexedTriMesh::Ptr mesh) const {
+        return postPasses(CollisionMesh::build(mesh, size_t(maxTriCountHint), buildMethod()));
+    }
+
+    // built once per mesh and build method, the leaf size slider only collapses it
+    CollisionMesh::Ptr buildFinestMesh(IndexedTriMesh::Ptr mesh) const {
+        if (buildCache == nullptr) return CollisionMesh::build(mesh, size_t(MIN_MAX_TRI_COUNT), buildMethod());
+        return buildCache->build(mesh, size_t(MIN_MAX_TRI_COUNT), buildMethod());
+    }
+
+    CollisionMesh::Ptr collapseCollisionMesh(CollisionMesh::Ptr finest) const {
+        return postPasses(finest->collapse(size_t(maxTriCountHint)));
+    }
+
+    CollisionMesh::Ptr postPasses(CollisionMesh::Ptr cMesh) const {
+        if (treeletOrder) cMesh->reorderNodes();
+        if (quantizedLeaves) cMesh->quantizeLeaves();
+        if (meshletLeaves) cMesh->makeMeshlets();
+        if (compressedNodes) cMesh->compressNodes();
+        return cMesh;
+    }
 };
 
 struct MeshEntry {
@@ -86,6 +134,264 @@ MeshEntry gMeshEntries[] = {
     {"Load Tetrahedra",  "tetra.obj" }
 };
 
+// batch query scaling: the same random walk of queries answered with 1, 2, 4, ... hardware threads
+void benchmarkThreads(ProximityQuery::Ptr query, const AABB& bbox, float radius) {
+    const size_t QUERY_COUNT = 1 << 20;
+
+    vector<vec3>    pts(QUERY_COUNT);
+    vector<float>   radii(QUERY_COUNT, radius);
+    vector<vec3>    outPts(QUERY_COUNT);
+    vector<float>   outDists(QUERY_COUNT);
+    vector<int>     outLeaves(QUERY_COUNT);
+
+    // a random walk keeps consecutive queries close to each other, like a sculpting brush would
+    auto size = bbox.max() - bbox.min();
+    auto pt = (bbox.max() + bbox.min()) * 0.5f;
+    for (auto& p : pts) {
+        auto step = vec3(float(rand()) / RAND_MAX - 0.5f, float(rand()) / RAND_MAX - 0.5f, float(rand()) / RAND_MAX - 0.5f) * size * 0.01f;
+        pt = glm::clamp(pt + step, bbox.min() - size * 0.5f, bbox.max() + size * 0.5f);
+        p = pt;
+    }
+
+    auto maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    double singleMs = 0.0;
+
+    cout << "Batch query benchmark: " << QUERY_COUNT << " queries, radius " << radius << endl;
+    for (size_t threads = 1; ; threads = std::min<size_t>(threads * 2, maxThreads)) {
+        auto executor = QueryExecutor::create(threads);
+
+        auto start = chrono::high_resolution_clock::now();
+        executor->closestPointsOnMesh(*query, QUERY_COUNT, pts.data(), radii.data(), outPts.data(), outDists.data(), outLeaves.data());
+        auto ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+        if (threads == 1) singleMs = ms;
+        cout << "  " << threads << " thread(s): " << ms << " ms, " << QUERY_COUNT / (ms * 1000.0) << " Mq/s, speedup x" << singleMs / ms << endl;
+
+        if (threads == maxThreads) break;
+    }
+}
+
+// builder comparison: build time, tree size and query cost of the same random walk of queries
+void benchmarkBuilders(IndexedTriMesh::Ptr mesh, size_t maxTriCountHint, float radius) {
+    const size_t QUERY_COUNT = 1 << 16;
+
+    auto bbox = mesh->bbox();
+    auto size = bbox.max() - bbox.min();
+    auto pt = (bbox.max() + bbox.min()) * 0.5f;
+
+    vector<vec3> pts(QUERY_COUNT);
+    for (auto& p : pts) {
+        auto step = vec3(float(rand()) / RAND_MAX - 0.5f, float(rand()) / RAND_MAX - 0.5f, float(rand()) / RAND_MAX - 0.5f) * size * 0.01f;
+        pt = glm::clamp(pt + step, bbox.min() - size * 0.5f, bbox.max() + size * 0.5f);
+        p = pt;
+    }
+
+    struct Method {
+        const char*                 name;
+        CollisionMesh::BuildMethod  method;
+    };
+
+    Method methods[] = {
+        { "Octree", CollisionMesh::BuildMethod::OCTREE },
+        { "SAH   ", CollisionMesh::BuildMethod::SAH },
+        { "LBVH  ", CollisionMesh::BuildMethod::LBVH }
+    };
+
+    cout << "Builder benchmark: " << mesh->triCount() << " triangles, max " << maxTriCountHint << " per leaf, " << QUERY_COUNT << " queries" << endl;
+    for (const auto& m : methods) {
+        auto start = chrono::high_resolution_clock::now();
+        auto cMesh = CollisionMesh::build(mesh, maxTriCountHint, m.method);
+        auto buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+        auto query = ProximityQuery::create(cMesh);
+
+        int leaf;
+        start = chrono::high_resolution_clock::now();
+        for (const auto& p : pts) {
+            query->closestPointOnMesh(p, radius, leaf);
+        }
+        auto radiusMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+        start = chrono::high_resolution_clock::now();
+        for (const auto& p : pts) {
+            query->closestPointOnMesh(p, leaf);
+        }
+        auto unboundedMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+        cout << "  " << m.name << ": build " << buildMs << " ms, " << cMesh->nodes().size() << " nodes, " << cMesh->leaves().size() << " leaves"
+             << " | query (radius) " << radiusMs * 1000.0 / QUERY_COUNT << " us"
+             << " | query (unbounded) " << unboundedMs * 1000.0 / QUERY_COUNT << " us" << endl;
+    }
+}
+
+// sculpting: brush strokes on a copy of the mesh, refit of the dirty triangles against a full rebuild
+void benchmarkRefit(IndexedTriMesh::Ptr mesh, const MainUi& ui, float brushRadius) {
+    const size_t STROKE_COUNT = 64;
+
+    auto vertices = mesh->vertices();
+    auto indices = mesh->indices();
+    auto copy = IndexedTriMesh::create(std::move(vertices), std::move(indices));
+    auto cMesh = ui.buildCollisionMesh(copy);
+
+    // the triangles of every vertex
+    vector<uint32_t> firstTri(copy->vertices().size() + 1, 0);
+    vector<uint32_t> vertexTris(copy->indices().size());
+    for (auto v : copy->indices()) ++firstTri[v + 1];
+    for (size_t v = 0; v < copy->vertices().size(); ++v) firstTri[v + 1] += firstTri[v];
+    auto next = firstTri;
+    for (size_t i = 0; i < copy->indices().size(); ++i) vertexTris[next[copy->indices()[i]]++] = uint32_t(i / 3);
+
+    auto size = glm::length(copy->bbox().max() - copy->bbox().min());
+    double refitMs = 0.0;
+    size_t dirtyCount = 0;
+
+    cout << "Refit benchmark: " << copy->triCount() << " triangles, " << STROKE_COUNT << " strokes, brush radius " << brushRadius << endl;
+    for (size_t s = 0; s < STROKE_COUNT; ++s) {
+        auto center = copy->vertices()[size_t(rand()) % copy->vertices().size()].position;
+
+        vector<uint32_t> dirty;
+        for (size_t v = 0; v < copy->vertices().size(); ++v) {
+            const auto& vertex = copy->vertices()[v];
+            auto d = glm::length(vertex.position - center);
+            if (d >= brushRadius) continue;
+
+            copy->setPosition(v, vertex.position + vertex.normal * (size * 0.01f * (1.0f - d / brushRadius)));
+            dirty.insert(dirty.end(), vertexTris.begin() + firstTri[v], vertexTris.begin() + firstTri[v + 1]);
+        }
+
+        auto start = chrono::high_resolution_clock::now();
+        cMesh->refit(dirty);
+        refitMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        dirtyCount += dirty.size();
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    ui.buildCollisionMesh(copy);
+    auto buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    cout << "  refit " << refitMs / STROKE_COUNT << " ms per stroke (" << dirtyCount / STROKE_COUNT << " dirty triangles)"
+         << " | rebuild " << buildMs << " ms | quality " << cMesh->refitQuality() << endl;
+}
+
+// topology edits: patches of a copy of the mesh cut out and inserted again pushed out, partial rebuilds against a full rebuild
+void benchmarkEdits(IndexedTriMesh::Ptr mesh, const MainUi& ui, float brushRadius) {
+    const size_t EDIT_COUNT = 64;
+
+    auto vertices = mesh->vertices();
+    auto indices = mesh->indices();
+    auto copy = IndexedTriMesh::create(std::move(vertices), std::move(indices));
+    auto cMesh = ui.buildCollisionMesh(copy);
+
+    auto size = glm::length(copy->bbox().max() - copy->bbox().min());
+    vector<uint8_t> removedTris(copy->triCount(), 0);
+    double editMs = 0.0;
+    size_t editCount = 0;
+
+    cout << "Edit benchmark: " << copy->triCount() << " triangles, " << EDIT_COUNT << " edits, brush radius " << brushRadius << endl;
+    for (size_t e = 0; e < EDIT_COUNT; ++e) {
+        auto center = copy->vertices()[size_t(rand()) % copy->vertices().size()].position;
+
+        vector<uint32_t> removed;
+        vector<uint32_t> inserted;
+        for (size_t t = 0; t < removedTris.size(); ++t) {
+            if (removedTris[t] || glm::length(copy->tri(t).v[0].position - center) >= brushRadius) continue;
+
+            uint32_t v[3];
+            for (size_t c = 0; c < 3; ++c) {
+                auto vertex = copy->vertices()[copy->indices()[t * 3 + c]];
+                vertex.position += vertex.normal * (size * 0.01f);
+                v[c] = copy->addVertex(vertex);
+            }
+            inserted.push_back(copy->addTri(v[0], v[1], v[2]));
+            removed.push_back(uint32_t(t));
+        }
+
+        for (auto t : removed) {
+            copy->removeTri(t);
+            removedTris[t] = 1;
+        }
+        removedTris.resize(copy->triCount(), 0);
+
+        auto start = chrono::high_resolution_clock::now();
+        cMesh->editTris(inserted, removed);
+        editMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        editCount += removed.size() + inserted.size();
+    }
+
+    auto fragmentation = cMesh->fragmentation();
+    auto start = chrono::high_resolution_clock::now();
+    cMesh->compact();
+    auto compactMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    start = chrono::high_resolution_clock::now();
+    ui.buildCollisionMesh(copy);
+    auto buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    cout << "  edit " << editMs / EDIT_COUNT << " ms per edit (" << editCount / EDIT_COUNT << " triangles)"
+         << " | fragmentation " << fragmentation << " | compact " << compactMs << " ms"
+         << " | rebuild " << buildMs << " ms | quality " << cMesh->refitQuality() << endl;
+}
+
+// startup: the collision mesh built (with the post passes) against saved once and mapped, the mapped one is queried in place
+void benchmarkMappedFile(IndexedTriMesh::Ptr mesh, const MainUi& ui, float radius) {
+    const size_t QUERY_COUNT = 1 << 12;
+    const char* fileName = "collision.pqcm";
+
+    auto start = chrono::high_resolution_clock::now();
+    auto cMesh = ui.buildCollisionMesh(mesh);
+    auto buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    start = chrono::high_resolution_clock::now();
+    if (!cMesh->saveTo(fileName)) return;
+    auto saveMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    start = chrono::high_resolution_clock::now();
+    auto mapped = CollisionMesh::mapFrom(fileName);
+    auto mapMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    if (mapped == nullptr) return;
+
+    auto bbox = mesh->bbox();
+    auto size = bbox.max() - bbox.min();
+    vector<vec3> pts(QUERY_COUNT);
+    for (auto& p : pts) {
+        p = bbox.min() + vec3(float(rand()) / RAND_MAX, float(rand()) / RAND_MAX, float(rand()) / RAND_MAX) * size;
+    }
+
+    // the first queries fault the touched pages in
+    auto query = ProximityQuery::create(cMesh);
+    auto mappedQuery = ProximityQuery::create(mapped);
+    size_t mismatches = 0;
+    int leaf, mappedLeaf;
+    start = chrono::high_resolution_clock::now();
+    for (const auto& p : pts) {
+        auto pt = mappedQuery->closestPointOnMesh(p, radius, mappedLeaf);
+        if (pt != query->closestPointOnMesh(p, radius, leaf) || leaf != mappedLeaf) ++mismatches;
+    }
+    auto queryMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    cout << "Mapped file benchmark: " << mesh->triCount() << " triangles, " << mapped->file()->size() / 1024 << " KB" << endl;
+    cout << "  build " << buildMs << " ms | save " << saveMs << " ms | map " << mapMs << " ms"
+         << " | first " << QUERY_COUNT << " queries (both meshes) " << queryMs << " ms, " << mismatches << " mismatches" << endl;
+}
+
+// build scaling: the same collision mesh built with 1, 2, 4, ... hardware threads
+void benchmarkBuildThreads(IndexedTriMesh::Ptr mesh, size_t maxTriCountHint, CollisionMesh::BuildMethod method) {
+    auto maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    double singleMs = 0.0;
+
+    cout << "Build benchmark: " << mesh->triCount() << " triangles, max " << maxTriCountHint << " per leaf" << endl;
+    for (size_t threads = 1; ; threads = std::min<size_t>(threads * 2, maxThreads)) {
+        auto start = chrono::high_resolution_clock::now();
+        auto cMesh = CollisionMesh::build(mesh, maxTriCountHint, method, threads);
+        auto ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+        if (threads == 1) singleMs = ms;
+        cout << "  " << threads << " thread(s): " << ms << " ms, speedup x" << singleMs / ms << endl;
+
+        if (threads == maxThreads) break;
+    }
+}
+
 void errorCallback(int error, const char* descriptor) {
     cerr << "GLFW3 Error 0x" << std::hex << error << std::dec << " - " << descriptor << endl;
 }
@@ -116,7 +422,8 @@ void doAllThings() {
         return;
     }
 
-    auto mesh = loadFrom("monkey.obj");
+    // the demo meshes stay indexed: the collision mesh and the views share the OBJ vertices
+    auto mesh = loadIndexedFrom("monkey.obj");
 
     if (mesh == nullptr) {
         cout << "Error: unable to load mesh" << endl;
@@ -125,11 +432,15 @@ void doAllThings() {
         cout << "Mesh Loaded!" << endl;
     }
 
-    auto cMesh = CollisionMesh::build(mesh, INITIAL_MAX_TRI_COUNT);
-    if (cMesh == nullptr) {
+    auto radius = glm::length(mesh->bbox().max() - mesh->bbox().min());
+    auto mainUi = MainUi::create(radius);
+
+    auto finestMesh = mainUi.buildFinestMesh(mesh);
+    if (finestMesh == nullptr) {
         cerr << "Error: Unable to build collision mesh" << endl;
         return;
     }
+    auto cMesh = mainUi.collapseCollisionMesh(finestMesh);
 
     auto meshShader = TriMeshShader::instance();
 
@@ -170,9 +481,6 @@ void doAllThings() {
     // glfw scrolling
     int mscroll = 0;
 
-    auto radius = glm::length(mesh->bbox().max() - mesh->bbox().min());
-    auto mainUi = MainUi::create(radius);
-
     auto trackBall = TrackBall::create();
 
     glfwSetScrollCallback(window, scrollCallback);
@@ -267,12 +575,12 @@ void doAllThings() {
         if (glm::length(closestPoint - pt) < mainUi.sphereRadius) {
             intersectColor = vec4(1.0f, 0.0f, 0.0f, 0.0f);
             lineQueueView->queueLine(mvp, pt, closestPoint, intersectColor);
-            if (leaf > cMesh->nodes().size()) {
+            if (size_t(leaf) >= cMesh->leaves().size()) {
                 cout << "ERROR!!!" << endl;
             }
 
-            auto lBox = cMesh->nodes()[leaf];
-            lineQueueView->queueCube(mvp, lBox.bbox(), true, intersectColor);
+            auto lBox = cMesh->leafBoxes()[leaf];
+            lineQueueView->queueCube(mvp, lBox, true, intersectColor);
 
             if (mainUi.showClosest) {
                 auto mvpClosest = mvp * translate(mat4(1.0f), closestPoint);
@@ -307,10 +615,11 @@ void doAllThings() {
 
         for (size_t i = 0; i < sizeof(gMeshEntries) / sizeof(MeshEntry); ++i) {
             if (imguiButton(gMeshEntries[i].uiString)) {
-                auto tmp = loadFrom(gMeshEntries[i].fileName);
+                auto tmp = loadIndexedFrom(gMeshEntries[i].fileName);
                 if (tmp != nullptr) {
                     mesh = tmp;
-                    cMesh = CollisionMesh::build(mesh, mainUi.maxTriCountHint);
+                    finestMesh = mainUi.buildFinestMesh(mesh);
+                    cMesh = mainUi.collapseCollisionMesh(finestMesh);
                     cMeshView = CollisionMeshView::from(cMesh);
                     meshView = TriMeshView::from(mesh);
                     pQuery = ProximityQuery::create(cMesh);
@@ -356,6 +665,30 @@ void doAllThings() {
 
         imguiSlider("Proximity Query Radius", &mainUi.sphereRadius, 0.f, radius, 0.1f);
 
+        if (imguiButton("Benchmark Builders")) {
+            benchmarkBuilders(mesh, size_t(mainUi.maxTriCountHint), mainUi.sphereRadius);
+        }
+
+        if (imguiButton("Benchmark Build Threads")) {
+            benchmarkBuildThreads(mesh, size_t(mainUi.maxTriCountHint), mainUi.buildMethod());
+        }
+
+        if (imguiButton("Benchmark Refit")) {
+            benchmarkRefit(mesh, mainUi, mainUi.sphereRadius);
+        }
+
+        if (imguiButton("Benchmark Edits")) {
+            benchmarkEdits(mesh, mainUi, mainUi.sphereRadius);
+        }
+
+        if (imguiButton("Benchmark Mapped File")) {
+            benchmarkMappedFile(mesh, mainUi, mainUi.sphereRadius);
+        }
+
+        if (imguiButton("Benchmark Batch Threads")) {
+            benchmarkThreads(pQuery, mesh->bbox(), mainUi.sphereRadius);
+        }
+
         imguiSeparatorLine();
         imguiLabel("Rotation");
         imguiSeparator();
@@ -365,9 +698,49 @@ void doAllThings() {
 
         imguiSeparatorLine();
         int lastCount = mainUi.maxTriCountHint;
-        imguiSlider("Max Triangle Count in Leaf", &mainUi.maxTriCountHint, 4.0f, 1024.0f, 4.0f);
-        if (lastCount != mainUi.maxTriCountHint) {
-            cMesh = CollisionMesh::build(mesh, mainUi.maxTriCountHint);
+        imguiSlider("Max Triangle Count in Leaf", &mainUi.maxTriCountHint, MIN_MAX_TRI_COUNT, 1024.0f, 4.0f);
+        bool toggleSAH = imguiCheck("SAH Builder", mainUi.sahBuilder);
+        if (toggleSAH) {
+            mainUi.sahBuilder = !mainUi.sahBuilder;
+            mainUi.lbvhBuilder = false;
+        }
+
+        bool toggleLBVH = imguiCheck("LBVH Builder", mainUi.lbvhBuilder);
+        if (toggleLBVH) {
+            mainUi.lbvhBuilder = !mainUi.lbvhBuilder;
+            mainUi.sahBuilder = false;
+        }
+
+        bool toggleTreelet = imguiCheck("Treelet Node Order", mainUi.treeletOrder);
+        if (toggleTreelet) {
+            mainUi.treeletOrder = !mainUi.treeletOrder;
+        }
+
+        bool toggleQuantized = imguiCheck("Quantized Leaves", mainUi.quantizedLeaves);
+        if (toggleQuantized) {
+            mainUi.quantizedLeaves = !mainUi.quantizedLeaves;
+            mainUi.meshletLeaves = false;
+        }
+
+        bool toggleMeshlets = imguiCheck("Meshlet Leaves", mainUi.meshletLeaves);
+        if (toggleMeshlets) {
+            mainUi.meshletLeaves = !mainUi.meshletLeaves;
+            mainUi.quantizedLeaves = false;
+        }
+
+        bool toggleCompressed = imguiCheck("Compressed Nodes", mainUi.compressedNodes);
+        if (toggleCompressed) {
+            mainUi.compressedNodes = !mainUi.compressedNodes;
+        }
+
+        toggle = toggleSAH || toggleLBVH || toggleTreelet || toggleQuantized || toggleMeshlets || toggleCompressed;
+
+        if (toggleSAH || toggleLBVH) {
+            finestMesh = mainUi.buildFinestMesh(mesh);
+        }
+
+        if (lastCount != mainUi.maxTriCountHint || toggle) {
+            cMesh = mainUi.collapseCollisionMesh(finestMesh);
             cMeshView = CollisionMeshView::from(cMesh);
             pQuery = ProximityQuery::create(cMesh);
         }
@@ -376,7 +749,10 @@ void doAllThings() {
 
         imguiEndFrame();
 
-        sprintf(buff, "CollisionMesh: %d nodes [%d bytes], %d triangle meshes", cMesh->nodes().size(), cMesh->nodes().size() * sizeof(AABBNode), cMesh->leaves().size());
+        bool compressedNodes = cMesh->nodeFormat() == CollisionMesh::NodeFormat::COMPRESSED;
+        auto nodeCount = compressedNodes ? cMesh->compressedNodes().size() : cMesh->nodes().size();
+        auto nodeSize = compressedNodes ? sizeof(CompressedNode) : sizeof(WideNode);
+        sprintf(buff, "CollisionMesh: %zu nodes [%zu bytes], %zu leaves", nodeCount, nodeCount * nodeSize, cMesh->leaves().size());
 
         imguiDrawText(30 + width / 4 * 2, height - 20, IMGUI_ALIGN_LEFT, buff, imguiRGBA(255, 255, 255, 255));
 